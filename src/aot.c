@@ -0,0 +1,181 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8_analysis.h"
+#include "chip8_config.h"
+#include "chip8_exec.h"
+#include "chip8_state.h"
+#include "helper.h"
+
+// Same limit as the JIT, so a single block never dominates the instruction budget of a frame
+#define MAX_BLOCK_LENGTH 64
+
+#define op_name(name) [CHIP8_OP_##name] = #name,
+
+static const char *const op_names[] = {
+    [CHIP8_OP_UNKNOWN] = "unknown",
+    CHIP8_OPS(op_name)
+};
+
+static void aot_emit_block(FILE *out, size_t index, const uint8_t *memory, uint16_t address, uint16_t length) {
+    fprintf(out, "// 0x%03X - 0x%03X\n", address, address + 2 * length - 1);
+    fprintf(out, "static int block_%zu_%03X(struct chip8_state *state, const struct chip8_config *config) {\n", index, address);
+
+    for (uint16_t i = 0; i < length; i++) {
+        struct chip8_instruction inst;
+        chip8_decode(&inst, get_opcode(memory, address + 2 * i));
+        fprintf(out, "    static const struct chip8_instruction i%u = {.handler = chip8_exec_%s, .opcode = 0x%04X, .nnn = 0x%03X, "
+                     ".op = CHIP8_OP_%s, .x = %u, .y = %u, .n = %u, .nn = 0x%02X};\n",
+                i, op_names[inst.op], inst.opcode, inst.nnn, op_names[inst.op], inst.x, inst.y, inst.n, inst.nn);
+    }
+    fprintf(out, "\n");
+
+    // The block starts with batch_clock at its first instruction
+    uint16_t clock = 0;
+    for (uint16_t i = 0; i < length; i++) {
+        struct chip8_instruction inst;
+        chip8_decode(&inst, get_opcode(memory, address + 2 * i));
+        if (chip8_op_uses_clock(inst.op)) {
+            fprintf(out, "    state->batch_clock += %u;\n", i - clock);
+            clock = i;
+        }
+        fprintf(out, "    if (chip8_exec_%s(state, config, &i%u) == -1) {\n        return -1;\n    }\n", op_names[inst.op], i);
+    }
+    fprintf(out, "    return 0;\n}\n\n");
+}
+
+static int aot_emit_program(FILE *out, const char *file, size_t index, const uint8_t *memory, uint16_t end) {
+    const struct chip8_analysis *analysis = chip8_analyze(memory, end);
+    if (analysis == NULL) {
+        return -1;
+    }
+
+    fprintf(out, "// %s\n\n", file);
+
+    fprintf(out, "static const uint8_t rom_%zu[] = {", index);
+    for (uint16_t a = PROGRAM_MEMORY_OFFSET; a < end; a++) {
+        fprintf(out, "%s0x%02X,", (a - PROGRAM_MEMORY_OFFSET) % 16 == 0 ? "\n    " : " ", memory[a]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    // Basic blocks longer than MAX_BLOCK_LENGTH are split into several functions
+    size_t num_instructions = 0;
+    for (uint16_t i = 0; i < analysis->num_blocks; i++) {
+        const struct chip8_basic_block *block = &analysis->blocks[i];
+        for (uint16_t offset = 0; offset < block->length; offset += MAX_BLOCK_LENGTH) {
+            uint16_t length = (block->length - offset > MAX_BLOCK_LENGTH) ? MAX_BLOCK_LENGTH : block->length - offset;
+            aot_emit_block(out, index, memory, block->start + 2 * offset, length);
+        }
+        num_instructions += block->length;
+    }
+
+    fprintf(out, "static const struct chip8_aot_block blocks_%zu[4096] = {\n", index);
+    for (uint16_t i = 0; i < analysis->num_blocks; i++) {
+        const struct chip8_basic_block *block = &analysis->blocks[i];
+        for (uint16_t offset = 0; offset < block->length; offset += MAX_BLOCK_LENGTH) {
+            uint16_t address = block->start + 2 * offset;
+            uint16_t length = (block->length - offset > MAX_BLOCK_LENGTH) ? MAX_BLOCK_LENGTH : block->length - offset;
+            fprintf(out, "    [0x%03X] = {block_%zu_%03X, %u},\n", address, index, address, length);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const struct chip8_aot_program program_%zu = {\n", index);
+    fprintf(out, "    .name = \"%s\",\n", file);
+    fprintf(out, "    .rom = rom_%zu,\n", index);
+    fprintf(out, "    .rom_length = sizeof(rom_%zu),\n", index);
+    fprintf(out, "    .blocks = blocks_%zu\n", index);
+    fprintf(out, "};\n\n");
+
+    fprintf(stderr, "%s: %u blocks, %zu instructions, %u calls%s%s%s\n", file, analysis->num_blocks, num_instructions, analysis->num_calls,
+            analysis->indirect_jumps ? ", indirect jumps" : "",
+            analysis->unknown_writes ? ", writes through unknown I" : "",
+            analysis->self_modifying ? ", self-modifying" : "");
+    return 0;
+}
+
+static void usage(void) {
+    fputs("Usage: chip8-aot [-o output.c] <file>...\n", stderr);
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    struct chip8_state *state = malloc(sizeof(*state));
+    if (state == NULL) {
+        return EXIT_FAILURE;
+    }
+    if (chip8_init_state(state, NULL) == -1) {
+        free(state);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = (output == NULL) ? stdout : fopen(output, "w");
+    if (out == NULL) {
+        fprintf(stderr, "%s: fopen: %s\n", __func__, strerror(errno));
+        chip8_close_state(state, NULL);
+        free(state);
+        return EXIT_FAILURE;
+    }
+
+    fputs("// Generated by chip8-aot, do not edit\n\n", out);
+    fputs("#include <stdint.h>\n\n", out);
+    fputs("#include \"chip8_aot.h\"\n#include \"chip8_config.h\"\n#include \"chip8_exec.h\"\n#include \"chip8_state.h\"\n\n", out);
+
+    int return_value = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        struct stat file_info;
+        chip8_reset_state(state, NULL);
+        if (stat(argv[i], &file_info) == -1 || chip8_load_program(state, NULL, argv[i]) == -1) {
+            fprintf(stderr, "%s: cannot load %s\n", __func__, argv[i]);
+            return_value = EXIT_FAILURE;
+            break;
+        }
+
+        if (aot_emit_program(out, argv[i], i - optind, state->memory, PROGRAM_MEMORY_OFFSET + file_info.st_size) == -1) {
+            return_value = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    fputs("const struct chip8_aot_program *const chip8_aot_programs[] = {\n", out);
+    for (int i = optind; i < argc && return_value == EXIT_SUCCESS; i++) {
+        fprintf(out, "    &program_%d,\n", i - optind);
+    }
+    fputs("    NULL\n};\n", out);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    if (return_value != EXIT_SUCCESS && output != NULL) {
+        remove(output);
+    }
+
+    chip8_close_state(state, NULL);
+    free(state);
+
+    return return_value;
+}
@@ -0,0 +1,365 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_config.h"
+#include "chip8_state.h"
+#include "chip8_wav.h"
+#include "helper.h"
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_SPEED 15250
+
+// One ROM run with one seed
+struct batch_job {
+    const char *rom;
+    uint64_t seed;
+
+    uint64_t screen_hash;
+    uint64_t audio_hash;
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t idle_frames;
+    double milliseconds;
+    const char *status;
+};
+
+// Each worker owns the job indices in [head, tail), packed as head << 32 | tail
+// The owner takes jobs from the head, idle workers steal them from the tail
+struct batch_worker {
+    pthread_t thread;
+    _Atomic uint64_t range;
+
+    struct batch_worker *workers;
+    size_t num_workers;
+    size_t index;
+
+    struct batch_job *jobs;
+    const struct chip8_config *config;
+    uint64_t max_frames;
+    bool hash_audio;
+};
+
+static uint64_t fnv1a_64(const uint8_t *data, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static bool batch_pop(struct batch_worker *worker, uint32_t *job) {
+    uint64_t range = atomic_load(&worker->range);
+    for (;;) {
+        uint32_t head = range >> 32;
+        uint32_t tail = (uint32_t) range;
+        if (head >= tail) {
+            return false;
+        }
+
+        uint64_t new_range = (uint64_t) (head + 1) << 32 | tail;
+        if (atomic_compare_exchange_weak(&worker->range, &range, new_range)) {
+            *job = head;
+            return true;
+        }
+    }
+}
+
+static bool batch_steal(struct batch_worker *victim, uint32_t *job) {
+    uint64_t range = atomic_load(&victim->range);
+    for (;;) {
+        uint32_t head = range >> 32;
+        uint32_t tail = (uint32_t) range;
+        if (head >= tail) {
+            return false;
+        }
+
+        uint64_t new_range = (uint64_t) head << 32 | (tail - 1);
+        if (atomic_compare_exchange_weak(&victim->range, &range, new_range)) {
+            *job = tail - 1;
+            return true;
+        }
+    }
+}
+
+static void batch_run_job(struct batch_job *job, const struct chip8_config *config, uint64_t max_frames, bool hash_audio) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    job->status = "ok";
+
+    struct chip8_state *state = malloc(sizeof(*state));
+    if (state == NULL) {
+        job->status = "error";
+        return;
+    }
+
+    if (chip8_init_state(state, config) == -1) {
+        free(state);
+        job->status = "error";
+        return;
+    }
+    chip8_seed_state(state, job->seed);
+
+    if (chip8_load_program(state, config, job->rom) == -1) {
+        job->status = "error";
+    }
+
+    // Only the hash is wanted, so the samples are dropped as soon as they are made
+    struct chip8_wav *wav = NULL;
+    if (hash_audio) {
+        wav = malloc(sizeof(*wav));
+        if (wav == NULL || chip8_open_wav(wav, NULL, config) == -1) {
+            free(wav);
+            wav = NULL;
+            job->status = "error";
+        }
+    }
+
+    for (job->frames = 0; job->frames < max_frames && strcmp(job->status, "ok") == 0 && !state->stopped; job->frames++) {
+        int64_t executed = chip8_advance_frame(state, config, job->frames);
+        if (executed == -1) {
+            job->status = "error";
+            break;
+        }
+        job->instructions += (uint64_t) executed;
+        job->idle_frames += state->idle;
+
+        if (wav != NULL) {
+            if (chip8_write_wav_frame(wav, state) == -1) {
+                job->status = "error";
+            }
+            wav->length = 0;
+        }
+    }
+
+    if (wav != NULL) {
+        job->audio_hash = wav->hash;
+        chip8_close_wav(wav, config);
+        free(wav);
+    }
+
+    if (state->stopped) {
+        job->status = "stopped";
+    }
+    // Plane 1 only counts once the program has used it, so single-plane hashes stay comparable
+    uint8_t screen[SCREEN_PLANES][SCREEN_BYTES];
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++) {
+        chip8_pack_plane(state, plane, screen[plane]);
+    }
+    job->screen_hash = fnv1a_64(&screen[0][0], state->multi_plane ? sizeof(screen) : sizeof(screen[0]));
+
+    chip8_close_state(state, config);
+    free(state);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->milliseconds = elapsed_ms(&start, &end);
+}
+
+static void *batch_worker_main(void *arg) {
+    struct batch_worker *worker = arg;
+
+    for (;;) {
+        uint32_t job;
+        bool found = batch_pop(worker, &job);
+
+        for (size_t i = 1; !found && i < worker->num_workers; i++) {
+            found = batch_steal(&worker->workers[(worker->index + i) % worker->num_workers], &job);
+        }
+
+        if (!found) {
+            return NULL;
+        }
+
+        batch_run_job(&worker->jobs[job], worker->config, worker->max_frames, worker->hash_audio);
+    }
+}
+
+// Parse a comma separated list of seeds
+static int parse_seeds(const char *list, uint64_t **seeds, size_t *num_seeds) {
+    *num_seeds = 1;
+    for (const char *c = list; *c != '\0'; c++) {
+        *num_seeds += (*c == ',');
+    }
+
+    *seeds = malloc(*num_seeds * sizeof(**seeds));
+    if (*seeds == NULL) {
+        return -1;
+    }
+
+    const char *c = list;
+    for (size_t i = 0; i < *num_seeds; i++) {
+        char *end;
+        errno = 0;
+        (*seeds)[i] = strtoull(c, &end, 0);
+        if (errno != 0 || end == c || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "%s: invalid seed list '%s'\n", __func__, list);
+            free(*seeds);
+            return -1;
+        }
+        c = end + 1;
+    }
+
+    return 0;
+}
+
+static void usage(void) {
+    fputs("Usage: chip8-batch [-f frames] [-j threads] [-i instructions per second] [-s seed,...] [-a] <file>...\n", stderr);
+}
+
+int main(int argc, char **argv) {
+    struct chip8_config config;
+    config.target_speed = DEFAULT_SPEED;
+    config.default_scale = 1;
+    config.turbo = true;
+    config.turbo_frame_skip = 0;
+    config.max_frames = 0;
+    config.phosphor = false;
+    config.waveform = WAVE_SINE;
+    config.low_latency_audio = false;
+
+    uint64_t max_frames = DEFAULT_FRAMES;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *seed_list = "0";
+    bool hash_audio = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:j:i:s:a")) != -1) {
+        switch (opt) {
+            case 'f':
+                max_frames = strtoull(optarg, NULL, 0);
+                break;
+            case 'j':
+                num_threads = strtol(optarg, NULL, 0);
+                break;
+            case 'i':
+                config.target_speed = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                seed_list = optarg;
+                break;
+            case 'a':
+                hash_audio = true;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || config.target_speed <= 0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    uint64_t *seeds;
+    size_t num_seeds;
+    if (parse_seeds(seed_list, &seeds, &num_seeds) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    size_t num_roms = argc - optind;
+    size_t num_jobs = num_roms * num_seeds;
+    if (num_jobs > UINT32_MAX) {
+        fprintf(stderr, "%s: too many jobs\n", __func__);
+        free(seeds);
+        return EXIT_FAILURE;
+    }
+    if ((size_t) num_threads > num_jobs) {
+        num_threads = num_jobs;
+    }
+
+    struct batch_job *jobs = calloc(num_jobs, sizeof(*jobs));
+    struct batch_worker *workers = calloc(num_threads, sizeof(*workers));
+    if (jobs == NULL || workers == NULL) {
+        free(jobs);
+        free(workers);
+        free(seeds);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        jobs[i].rom = argv[optind + i / num_seeds];
+        jobs[i].seed = seeds[i % num_seeds];
+    }
+
+    // Hand each worker a contiguous share of the jobs up front
+    for (size_t i = 0; i < (size_t) num_threads; i++) {
+        uint64_t head = num_jobs * i / num_threads;
+        uint64_t tail = num_jobs * (i + 1) / num_threads;
+        atomic_init(&workers[i].range, head << 32 | tail);
+        workers[i].workers = workers;
+        workers[i].num_workers = num_threads;
+        workers[i].index = i;
+        workers[i].jobs = jobs;
+        workers[i].config = &config;
+        workers[i].max_frames = max_frames;
+        workers[i].hash_audio = hash_audio;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t num_started = 0;
+    for (; num_started < (size_t) num_threads; num_started++) {
+        int err = pthread_create(&workers[num_started].thread, NULL, batch_worker_main, &workers[num_started]);
+        if (err != 0) {
+            fprintf(stderr, "%s: pthread_create: %s\n", __func__, strerror(err));
+            break;
+        }
+    }
+
+    // Jobs left to workers that failed to start are stolen by the ones that did
+    if (num_started == 0) {
+        batch_worker_main(&workers[0]);
+    }
+    for (size_t i = 0; i < num_started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int return_value = EXIT_SUCCESS;
+    uint64_t total_instructions = 0;
+    printf("%-32s %18s %16s %16s %8s %12s %8s %10s %s\n", "rom", "seed", "screen_hash", "audio_hash", "frames", "instructions", "idle", "ms", "status");
+    for (size_t i = 0; i < num_jobs; i++) {
+        const struct batch_job *job = &jobs[i];
+        char audio_hash[17] = "-";
+        if (hash_audio) {
+            snprintf(audio_hash, sizeof(audio_hash), "%016" PRIx64, job->audio_hash);
+        }
+        printf("%-32s %18" PRIu64 " %016" PRIx64 " %16s %8" PRIu64 " %12" PRIu64 " %8" PRIu64 " %10.2f %s\n",
+               job->rom, job->seed, job->screen_hash, audio_hash, job->frames, job->instructions, job->idle_frames, job->milliseconds, job->status);
+
+        total_instructions += job->instructions;
+        if (strcmp(job->status, "error") == 0) {
+            return_value = EXIT_FAILURE;
+        }
+    }
+
+    double total_ms = elapsed_ms(&start, &end);
+    printf("%zu jobs on %zu threads in %.2f ms, %.1f million instructions per second\n",
+           num_jobs, num_started > 0 ? num_started : 1, total_ms, total_instructions / (total_ms * 1e3));
+
+    free(workers);
+    free(jobs);
+    free(seeds);
+
+    return return_value;
+}
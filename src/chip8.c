@@ -1,26 +1,25 @@
 #define _GNU_SOURCE
 
-#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <SDL2/SDL.h>
-
 #include "chip8.h"
 #include "chip8_audio.h"
 #include "chip8_config.h"
 #include "chip8_display.h"
 #include "chip8_exec.h"
+#include "chip8_frame.h"
+#include "chip8_record.h"
 #include "chip8_state.h"
-
-#define MAX_PROGRAM_LENGTH (sizeof(((struct chip8_state *) NULL)->memory) - PROGRAM_MEMORY_OFFSET)
-#define PROGRAM_MEMORY_OFFSET 0x200
+#include "chip8_wav.h"
 
 static uint64_t current_time_ns(void) {
     struct timespec ts;
@@ -40,149 +39,162 @@ static void wait_until(uint64_t ns) {
     }
 }
 
-static int fread_all(uint8_t *buf, size_t length, FILE *f) {
-    size_t read = 0;
+// Shared between the thread driving the display and the emulation thread
+struct chip8_runner {
+    struct chip8_state *state;
+    struct chip8_audio *audio;
+    struct chip8_recorder *recorder;
+    struct chip8_wav *wav;
+    const struct chip8_config *config;
+
+    struct chip8_frame_buffer frames;
+
+    // Bit n is set while key n is held
+    _Atomic uint16_t keys;
+    _Atomic bool pause;
+    _Atomic bool turbo;
+    _Atomic bool should_continue;
+    int return_value;
+};
+
+// Runs the emulated frames at their own pace and hands finished screens to the display thread
+static void *chip8_emulate(void *arg) {
+    struct chip8_runner *runner = arg;
+    struct chip8_state *state = runner->state;
+    const struct chip8_config *config = runner->config;
+
+    uint64_t frame_number = 0;
+
+    // Turbo mode runs emulated frames back to back and only publishes some of them
+    uint64_t next_present_time = 0;
+
+    while (atomic_load(&runner->should_continue)) {
+        uint64_t current_time = current_time_ns();
+        uint64_t next_time = current_time + 1000000000ull / 60;
+        bool turbo = atomic_load(&runner->turbo);
 
-    while (read < length) {
-        size_t r = fread(&buf[read], sizeof(*buf), length - read, f);
-        if (r == 0) {
-            fprintf(stderr, "%s: fread failed\n", __func__);
-            return -1;
+        bool present = !turbo;
+        if (turbo && config->turbo_frame_skip > 0) {
+            present = (frame_number % config->turbo_frame_skip == 0);
+        } else if (turbo) {
+            present = (current_time >= next_present_time);
         }
-        read += r;
-    }
 
-    return 0;
-}
+        uint16_t keys = atomic_load(&runner->keys);
+        for (uint8_t i = 0; i < 16; i++) {
+            state->keys[i] = (keys >> i) & 1;
+        }
 
-int chip8_load_program(struct chip8_state *state, const struct chip8_config *config, const char *file) {
-    (void) config;
+        if (!atomic_load(&runner->pause)) {
+            if (chip8_advance_frame(state, config, frame_number) == -1) {
+                runner->return_value = -1;
+                atomic_store(&runner->should_continue, false);
+            }
+            // A turbo run has no real time to keep up with, so it waits for the writer instead of leaving holes
+            if (runner->recorder != NULL) {
+                chip8_record_frame(runner->recorder, state, frame_number, turbo);
+            }
+            // Unlike the device, the capture takes every frame, turbo or not
+            // It stops at the first failure, and closing it then reports the run as failed
+            if (runner->wav != NULL && chip8_write_wav_frame(runner->wav, state) == -1) {
+                fprintf(stderr, "%s: audio capture failed at frame %" PRIu64 ", no longer capturing\n", __func__, frame_number);
+                runner->wav = NULL;
+            }
+        }
 
-    struct stat file_info;
-    if (stat(file, &file_info) == -1) {
-        fprintf(stderr, "%s: stat: %s\n", __func__, strerror(errno));
-        return -1;
-    }
-    if (file_info.st_size > MAX_PROGRAM_LENGTH) {
-        fprintf(stderr, "%s: program must not exceed %zu bytes\n", __func__, (size_t) MAX_PROGRAM_LENGTH);
-        return -1;
-    }
+        // The last frame is always published so a limited run ends on what it drew
+        bool last = (config->max_frames > 0 && frame_number + 1 >= (uint64_t) config->max_frames);
+        if (present || last) {
+            chip8_capture_frame(chip8_back_frame(&runner->frames), state, frame_number);
+            chip8_publish_frame(&runner->frames);
+            next_present_time = current_time + 1000000000ull / 60;
+        }
 
-    FILE *f = fopen(file, "rb");
-    if (f == NULL) {
-        fprintf(stderr, "%s: fopen: %s\n", __func__, strerror(errno));
-        return -1;
-    }
+        // The beeper would only chatter at turbo speed, so turbo frames stay silent
+        if (runner->audio != NULL && !turbo) {
+            if (chip8_update_audio(runner->audio, state, config) == -1) {
+                runner->return_value = -1;
+                atomic_store(&runner->should_continue, false);
+            }
+        }
 
-    if (fread_all(&state->memory[PROGRAM_MEMORY_OFFSET], file_info.st_size, f) == -1) {
-        fclose(f);
-        return -1;
+        frame_number++;
+        if (last) {
+            break;
+        }
+        if (!turbo) {
+            wait_until(next_time);
+        }
     }
-    memset(&state->memory[PROGRAM_MEMORY_OFFSET + file_info.st_size], 0, MAX_PROGRAM_LENGTH - file_info.st_size);
 
-    fclose(f);
-    return 0;
+    // Stopped on its own, let the display thread show the last frame and return
+    atomic_store(&runner->should_continue, false);
+    return NULL;
 }
 
-int chip8_run(struct chip8_state *state, struct chip8_display *display, struct chip8_audio *audio, const struct chip8_config *config) {
-    (void) config;
+// Backends such as SDL want events and rendering on the main thread, so emulation moves to a thread of its own instead
+// The calling thread shows the newest published frame at up to 60 Hz and never waits on the emulator
+// audio may be NULL to run silently, recorder and wav may be NULL to not record
+int chip8_run(struct chip8_state *state, struct chip8_display *display, struct chip8_audio *audio, struct chip8_recorder *recorder, struct chip8_wav *wav, const struct chip8_config *config) {
+    static struct chip8_runner runner;
+    runner.state = state;
+    runner.audio = audio;
+    runner.recorder = recorder;
+    runner.wav = wav;
+    runner.config = config;
+    runner.return_value = 0;
+    chip8_init_frame_buffer(&runner.frames);
+    atomic_init(&runner.keys, 0);
+    atomic_init(&runner.pause, false);
+    atomic_init(&runner.turbo, config->turbo);
+    atomic_init(&runner.should_continue, true);
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, chip8_emulate, &runner);
+    if (err != 0) {
+        fprintf(stderr, "%s: pthread_create: %s\n", __func__, strerror(err));
+        return -1;
+    }
 
     int return_value = 0;
-    bool should_continue = true;
-    bool pause = false;
-
-    uint64_t frame_number = 0;
-    uint64_t num_instructions = 0;
+    struct chip8_input input = {0};
+    bool emulating = true;
 
-    while (should_continue) {
+    while (emulating) {
         uint64_t next_time = current_time_ns() + 1000000000ull / 60;
 
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_KEYDOWN) {
-                switch (event.key.keysym.scancode) {
-                    case SDL_SCANCODE_1: state->keys[0x1] = true; break;
-                    case SDL_SCANCODE_2: state->keys[0x2] = true; break;
-                    case SDL_SCANCODE_3: state->keys[0x3] = true; break;
-                    case SDL_SCANCODE_4: state->keys[0xC] = true; break;
-                    case SDL_SCANCODE_Q: state->keys[0x4] = true; break;
-                    case SDL_SCANCODE_W: state->keys[0x5] = true; break;
-                    case SDL_SCANCODE_E: state->keys[0x6] = true; break;
-                    case SDL_SCANCODE_R: state->keys[0xD] = true; break;
-                    case SDL_SCANCODE_A: state->keys[0x7] = true; break;
-                    case SDL_SCANCODE_S: state->keys[0x8] = true; break;
-                    case SDL_SCANCODE_D: state->keys[0x9] = true; break;
-                    case SDL_SCANCODE_F: state->keys[0xE] = true; break;
-                    case SDL_SCANCODE_Z: state->keys[0xA] = true; break;
-                    case SDL_SCANCODE_X: state->keys[0x0] = true; break;
-                    case SDL_SCANCODE_C: state->keys[0xB] = true; break;
-                    case SDL_SCANCODE_V: state->keys[0xF] = true; break;
-                    case SDL_SCANCODE_P: pause = !pause; break;
-                    case SDL_SCANCODE_ESCAPE: should_continue = false; break;
-                    default: break;
-                }
-            }
+        // Checked before taking the frame, so the one published last is still shown
+        emulating = atomic_load(&runner.should_continue);
 
-            if (event.type == SDL_KEYUP) {
-                switch (event.key.keysym.scancode) {
-                    case SDL_SCANCODE_1: state->keys[0x1] = false; break;
-                    case SDL_SCANCODE_2: state->keys[0x2] = false; break;
-                    case SDL_SCANCODE_3: state->keys[0x3] = false; break;
-                    case SDL_SCANCODE_4: state->keys[0xC] = false; break;
-                    case SDL_SCANCODE_Q: state->keys[0x4] = false; break;
-                    case SDL_SCANCODE_W: state->keys[0x5] = false; break;
-                    case SDL_SCANCODE_E: state->keys[0x6] = false; break;
-                    case SDL_SCANCODE_R: state->keys[0xD] = false; break;
-                    case SDL_SCANCODE_A: state->keys[0x7] = false; break;
-                    case SDL_SCANCODE_S: state->keys[0x8] = false; break;
-                    case SDL_SCANCODE_D: state->keys[0x9] = false; break;
-                    case SDL_SCANCODE_F: state->keys[0xE] = false; break;
-                    case SDL_SCANCODE_Z: state->keys[0xA] = false; break;
-                    case SDL_SCANCODE_X: state->keys[0x0] = false; break;
-                    case SDL_SCANCODE_C: state->keys[0xB] = false; break;
-                    case SDL_SCANCODE_V: state->keys[0xF] = false; break;
-                    default: break;
-                }
-            }
-            
-            if (event.type == SDL_QUIT) {
-                should_continue = false;
-            }
+        if (chip8_poll_display(display, &input, config) == -1) {
+            return_value = -1;
+            input.quit = true;
         }
-
-        if (!pause) {
-            while (num_instructions < config->target_speed * ((frame_number % 60) + 1) / 60) {
-                if (chip8_advance_state(state, config) == -1) {
-                    should_continue = false;
-                    return_value = -1;
-                    break;
-                }
-                num_instructions++;
-            }
-
-            if (state->delay_timer > 0) {
-                state->delay_timer--;
-            }
-
-            if (state->sound_timer > 0) {
-                state->sound_timer--;
-            }
+        atomic_store(&runner.keys, input.keys);
+        if (input.toggle_pause) {
+            atomic_store(&runner.pause, !atomic_load(&runner.pause));
         }
-
-        if (chip8_update_display(display, state, config) == -1) {
-            should_continue = false;
-            return_value = -1;
+        if (input.toggle_turbo) {
+            atomic_store(&runner.turbo, !atomic_load(&runner.turbo));
         }
+        input.toggle_pause = false;
+        input.toggle_turbo = false;
 
-        if (chip8_update_audio(audio, state, config) == -1) {
-            should_continue = false;
+        if (chip8_update_display(display, chip8_take_frame(&runner.frames), config) == -1) {
             return_value = -1;
+            input.quit = true;
         }
 
-        frame_number++;
-        num_instructions = 0;
-        wait_until(next_time);
+        if (input.quit) {
+            atomic_store(&runner.should_continue, false);
+            break;
+        }
+        if (emulating) {
+            wait_until(next_time);
+        }
     }
 
-    return return_value;
+    pthread_join(thread, NULL);
+
+    return (runner.return_value == -1) ? -1 : return_value;
 }
@@ -0,0 +1,259 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_analysis.h"
+#include "chip8_exec.h"
+#include "chip8_state.h"
+#include "helper.h"
+
+// Analyses are kept for the life of the process, keyed by a hash of the ROM
+// States point straight into the cache, so entries are never freed
+struct chip8_analysis_entry {
+    struct chip8_analysis analysis;
+    struct chip8_analysis_entry *next;
+};
+
+static struct chip8_analysis_entry *g_cache = NULL;
+static atomic_flag g_cache_lock = ATOMIC_FLAG_INIT;
+
+struct chip8_worklist {
+    uint16_t size;
+    uint16_t addresses[4096];
+    bool visited[4096];
+};
+
+static uint64_t fnv1a_64(const uint8_t *data, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+static void chip8_analysis_push(struct chip8_analysis *analysis, struct chip8_worklist *worklist, uint16_t address, bool leader) {
+    if (address < PROGRAM_MEMORY_OFFSET || address + 1 >= analysis->end) {
+        return;
+    }
+
+    if (leader) {
+        analysis->flags[address] |= ANALYSIS_LEADER;
+    }
+    if (!worklist->visited[address]) {
+        worklist->visited[address] = true;
+        worklist->addresses[worklist->size++] = address;
+    }
+}
+
+static bool chip8_analysis_ends_block(uint8_t op) {
+    switch (op) {
+        case CHIP8_OP_00EE: case CHIP8_OP_00FD: case CHIP8_OP_1NNN: case CHIP8_OP_2NNN: case CHIP8_OP_BXNN:
+        case CHIP8_OP_3XNN: case CHIP8_OP_4XNN: case CHIP8_OP_5XY0: case CHIP8_OP_9XY0:
+        case CHIP8_OP_EX9E: case CHIP8_OP_EXA1: case CHIP8_OP_FX0A: case CHIP8_OP_FX33: case CHIP8_OP_FX55:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Same patterns as chip8_is_idle, minus the conditions that depend on registers and keys
+static bool chip8_analysis_is_wait(const uint8_t *memory, uint16_t address, const struct chip8_instruction *inst) {
+    if (inst->op == CHIP8_OP_FX0A) {
+        return true;
+    }
+    if (inst->op != CHIP8_OP_1NNN) {
+        return false;
+    }
+    if (inst->nnn == address) {
+        return true;
+    }
+    if (inst->nnn + 4 != address) {
+        return false;
+    }
+
+    uint16_t poll = get_opcode(memory, inst->nnn);
+    uint16_t test = get_opcode(memory, inst->nnn + 2);
+    return get_h(poll) == 0xF && get_nn(poll) == 0x07 && get_x(test) == get_x(poll) && (get_h(test) == 0x3 || get_h(test) == 0x4);
+}
+
+// Find every reachable instruction by following jumps, calls, return sites and both sides of each skip
+static void chip8_analysis_trace(struct chip8_analysis *analysis, const uint8_t *memory) {
+    static _Thread_local struct chip8_worklist worklist;
+    memset(&worklist, 0, sizeof(worklist));
+
+    chip8_analysis_push(analysis, &worklist, PROGRAM_MEMORY_OFFSET, true);
+
+    while (worklist.size > 0) {
+        uint16_t address = worklist.addresses[--worklist.size];
+
+        struct chip8_instruction inst;
+        chip8_decode(&inst, get_opcode(memory, address));
+        if (inst.op == CHIP8_OP_UNKNOWN) {
+            continue;
+        }
+
+        analysis->flags[address] |= ANALYSIS_INSTRUCTION | ANALYSIS_CODE;
+        analysis->flags[address + 1] |= ANALYSIS_CODE;
+        if (chip8_analysis_is_wait(memory, address, &inst)) {
+            analysis->flags[address] |= ANALYSIS_WAIT;
+        }
+
+        switch (inst.op) {
+            case CHIP8_OP_00EE: case CHIP8_OP_00FD:
+                break;
+
+            case CHIP8_OP_BXNN:
+                analysis->indirect_jumps = true;
+                break;
+
+            case CHIP8_OP_1NNN:
+                chip8_analysis_push(analysis, &worklist, inst.nnn, true);
+                break;
+
+            case CHIP8_OP_2NNN:
+                if (analysis->num_calls < sizeof(analysis->calls) / sizeof(analysis->calls[0])) {
+                    analysis->calls[analysis->num_calls++] = (struct chip8_call) {address, inst.nnn};
+                }
+                if (inst.nnn >= PROGRAM_MEMORY_OFFSET && inst.nnn + 1 < analysis->end) {
+                    analysis->flags[inst.nnn] |= ANALYSIS_SUBROUTINE;
+                }
+                chip8_analysis_push(analysis, &worklist, inst.nnn, true);
+                chip8_analysis_push(analysis, &worklist, address + 2, true);
+                break;
+
+            case CHIP8_OP_3XNN: case CHIP8_OP_4XNN: case CHIP8_OP_5XY0: case CHIP8_OP_9XY0:
+            case CHIP8_OP_EX9E: case CHIP8_OP_EXA1:
+                chip8_analysis_push(analysis, &worklist, address + 2, true);
+                chip8_analysis_push(analysis, &worklist, address + 4, true);
+                break;
+
+            default:
+                chip8_analysis_push(analysis, &worklist, address + 2, chip8_analysis_ends_block(inst.op));
+                break;
+        }
+    }
+}
+
+// Split the reachable code into basic blocks and note where FX33 and FX55 write
+// I is only tracked from an ANNN in the same block
+static void chip8_analysis_blocks(struct chip8_analysis *analysis, const uint8_t *memory) {
+    for (uint16_t start = PROGRAM_MEMORY_OFFSET; start < analysis->end; start++) {
+        if (!(analysis->flags[start] & ANALYSIS_LEADER) || !(analysis->flags[start] & ANALYSIS_INSTRUCTION)) {
+            continue;
+        }
+
+        struct chip8_basic_block *block = &analysis->blocks[analysis->num_blocks++];
+        block->start = start;
+        block->length = 0;
+
+        bool index_known = false;
+        uint16_t index = 0;
+
+        for (uint16_t a = start; a + 1 < analysis->end && (analysis->flags[a] & ANALYSIS_INSTRUCTION); a += 2) {
+            if (a != start && (analysis->flags[a] & ANALYSIS_LEADER)) {
+                break;
+            }
+
+            struct chip8_instruction inst;
+            chip8_decode(&inst, get_opcode(memory, a));
+            block->length++;
+
+            switch (inst.op) {
+                case CHIP8_OP_ANNN:
+                    index_known = true;
+                    index = inst.nnn;
+                    break;
+
+                case CHIP8_OP_FX1E: case CHIP8_OP_FX29: case CHIP8_OP_FX30:
+                    index_known = false;
+                    break;
+
+                case CHIP8_OP_FX33: case CHIP8_OP_FX55: {
+                    uint16_t length = (inst.op == CHIP8_OP_FX33) ? 3 : inst.x + 1;
+                    if (!index_known) {
+                        analysis->unknown_writes = true;
+                        break;
+                    }
+                    for (uint16_t i = 0; i < length; i++) {
+                        analysis->flags[(index + i) & 0xFFF] |= ANALYSIS_WRITTEN;
+                    }
+                    break;
+                }
+
+                default:
+                    break;
+            }
+
+            if (chip8_analysis_ends_block(inst.op)) {
+                break;
+            }
+        }
+    }
+
+    for (uint16_t a = 0; a < sizeof(analysis->flags); a++) {
+        if ((analysis->flags[a] & ANALYSIS_WRITTEN) && (analysis->flags[a] & ANALYSIS_CODE)) {
+            analysis->self_modifying = true;
+        }
+    }
+}
+
+static const struct chip8_analysis *chip8_analysis_lookup(const uint8_t *rom, uint16_t end, uint64_t hash) {
+    for (struct chip8_analysis_entry *entry = g_cache; entry != NULL; entry = entry->next) {
+        const struct chip8_analysis *analysis = &entry->analysis;
+        if (analysis->hash == hash && analysis->end == end && memcmp(analysis->rom, rom, end - PROGRAM_MEMORY_OFFSET) == 0) {
+            return analysis;
+        }
+    }
+    return NULL;
+}
+
+// Analyse the ROM occupying memory from PROGRAM_MEMORY_OFFSET up to end
+// Results are cached, so loading the same ROM again costs one hash
+const struct chip8_analysis *chip8_analyze(const uint8_t *memory, uint16_t end) {
+    if (end < PROGRAM_MEMORY_OFFSET || end > 4096) {
+        return NULL;
+    }
+
+    const uint8_t *rom = &memory[PROGRAM_MEMORY_OFFSET];
+    uint64_t hash = fnv1a_64(rom, end - PROGRAM_MEMORY_OFFSET);
+
+    while (atomic_flag_test_and_set_explicit(&g_cache_lock, memory_order_acquire));
+    const struct chip8_analysis *cached = chip8_analysis_lookup(rom, end, hash);
+    atomic_flag_clear_explicit(&g_cache_lock, memory_order_release);
+
+    if (cached != NULL) {
+        return cached;
+    }
+
+    // Analyse without holding the lock, another thread may be loading a different ROM
+    struct chip8_analysis_entry *entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    struct chip8_analysis *analysis = &entry->analysis;
+    analysis->hash = hash;
+    analysis->end = end;
+    memcpy(analysis->rom, rom, end - PROGRAM_MEMORY_OFFSET);
+
+    chip8_analysis_trace(analysis, memory);
+    chip8_analysis_blocks(analysis, memory);
+
+    while (atomic_flag_test_and_set_explicit(&g_cache_lock, memory_order_acquire));
+    cached = chip8_analysis_lookup(rom, end, hash);
+    if (cached == NULL) {
+        entry->next = g_cache;
+        g_cache = entry;
+    }
+    atomic_flag_clear_explicit(&g_cache_lock, memory_order_release);
+
+    if (cached != NULL) {
+        free(entry);
+        return cached;
+    }
+    return analysis;
+}
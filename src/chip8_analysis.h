@@ -0,0 +1,56 @@
+#ifndef CHIP8_ANALYSIS_H
+#define CHIP8_ANALYSIS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_state.h"
+
+// Per-address facts, several may be set at once
+enum chip8_analysis_flag {
+    ANALYSIS_INSTRUCTION = 1 << 0, // A reachable instruction starts here
+    ANALYSIS_CODE        = 1 << 1, // Byte belongs to a reachable instruction, anything else in the ROM is data
+    ANALYSIS_LEADER      = 1 << 2, // First instruction of a basic block
+    ANALYSIS_SUBROUTINE  = 1 << 3, // Target of a 2NNN
+    ANALYSIS_WRITTEN     = 1 << 4, // Written by an FX33 or FX55 whose I is known
+    ANALYSIS_WAIT        = 1 << 5  // May be where a wait loop spins, see chip8_is_idle
+};
+
+// Runs until just after a jump, call, return, skip, FX0A, FX33 or FX55, or until the next leader
+struct chip8_basic_block {
+    uint16_t start;
+    uint16_t length;
+};
+
+// An edge of the call graph
+struct chip8_call {
+    uint16_t site;
+    uint16_t target;
+};
+
+// Static control flow of a ROM as loaded at PROGRAM_MEMORY_OFFSET, found by following every edge from the entry point
+struct chip8_analysis {
+    uint64_t hash;
+    uint16_t end;
+    uint8_t rom[4096 - PROGRAM_MEMORY_OFFSET];
+
+    uint8_t flags[4096];
+
+    // Leaders can sit at odd and even addresses alike, so every address may start a block
+    uint16_t num_blocks;
+    struct chip8_basic_block blocks[4096];
+
+    uint16_t num_calls;
+    struct chip8_call calls[4096 / 2];
+
+    // BXNN is reachable, so there is code the analysis could not see
+    bool indirect_jumps;
+    // An FX33 or FX55 is reachable with an I that could not be worked out
+    bool unknown_writes;
+    // A write with a known I lands on code
+    bool self_modifying;
+};
+
+const struct chip8_analysis *chip8_analyze(const uint8_t *memory, uint16_t end);
+
+#endif // CHIP8_ANALYSIS_H
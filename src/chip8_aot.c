@@ -0,0 +1,62 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8_aot.h"
+#include "chip8_config.h"
+#include "chip8_exec.h"
+#include "chip8_state.h"
+
+// Replaced by the table in the generated code when any ROMs are compiled in
+__attribute__((weak)) const struct chip8_aot_program *const chip8_aot_programs[] = {NULL};
+
+// Find the compiled version of a ROM, if there is one
+const struct chip8_aot_program *chip8_find_aot(const uint8_t *rom, size_t length) {
+    // Walk a pointer rather than the array, its size here is that of the weak default
+    for (const struct chip8_aot_program *const *p = chip8_aot_programs; *p != NULL; p++) {
+        const struct chip8_aot_program *program = *p;
+        if (program->rom_length == length && memcmp(program->rom, rom, length) == 0) {
+            return program;
+        }
+    }
+    return NULL;
+}
+
+// Execute count instructions, running compiled blocks where possible and stopping early once idle
+// Returns how many instructions ran, or -1 on error
+// A block only runs while memory still holds the code it was compiled from, everything else is interpreted
+int64_t chip8_run_aot(struct chip8_state *state, const struct chip8_config *config, uint64_t count) {
+    const uint64_t total = count;
+    const struct chip8_aot_program *program = state->aot;
+
+    while (count > 0) {
+        if (chip8_is_idle(state)) {
+            state->idle = true;
+            return (int64_t) (total - count);
+        }
+
+        // Blocks advance the clock themselves before each instruction that reads it
+        state->batch_clock = total - count;
+
+        uint16_t pc = state->pc;
+        if (pc >= PROGRAM_MEMORY_OFFSET && pc < PROGRAM_MEMORY_OFFSET + program->rom_length) {
+            const struct chip8_aot_block *block = &program->blocks[pc];
+            const uint8_t *original = &program->rom[pc - PROGRAM_MEMORY_OFFSET];
+
+            if (block->code != NULL && block->length <= count && memcmp(&state->memory[pc], original, 2 * block->length) == 0) {
+                if (block->code(state, config) == -1) {
+                    return -1;
+                }
+                count -= block->length;
+                continue;
+            }
+        }
+
+        if (chip8_advance_state(state, config) == -1) {
+            return -1;
+        }
+        count--;
+    }
+
+    return (int64_t) total;
+}
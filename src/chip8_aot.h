@@ -0,0 +1,33 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_config.h"
+#include "chip8_state.h"
+
+// A basic block of a ROM translated to C by chip8-aot
+typedef int chip8_aot_code(struct chip8_state *state, const struct chip8_config *config);
+
+struct chip8_aot_block {
+    chip8_aot_code *code;
+    uint16_t length;
+};
+
+struct chip8_aot_program {
+    const char *name;
+    const uint8_t *rom;
+    size_t rom_length;
+
+    // Indexed by the address of the first instruction, code is NULL where no block starts
+    const struct chip8_aot_block *blocks;
+};
+
+// NULL terminated, provided by the generated code when built with AOT=...
+extern const struct chip8_aot_program *const chip8_aot_programs[];
+
+const struct chip8_aot_program *chip8_find_aot(const uint8_t *rom, size_t length);
+int64_t chip8_run_aot(struct chip8_state *state, const struct chip8_config *config, uint64_t count);
+
+#endif // CHIP8_AOT_H
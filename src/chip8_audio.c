@@ -1,53 +1,44 @@
-#include <math.h>
 #include <SDL2/SDL.h>
 
 #include "chip8_audio.h"
 #include "chip8_config.h"
+#include "chip8_sound.h"
 #include "chip8_state.h"
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846L
-#endif
-
-static const int SAMPLE_RATE = 44100;
-static const int NUM_SAMPLES = 4096;
-static const double VOLUME = 0.8;
-
-static int g_step_num = 0;
-static int g_frequency;
-static double g_step_size;
+// Small, the ring already absorbs the jitter between emulated frames and the callback
+static const int NUM_SAMPLES = 512;
 
 static void SDLCALL audio_callback(void *userdata, uint8_t *stream, int len) {
-    (void) userdata;
-    
-    float *fstream = (float *) stream;
-    for (int i = 0; i < len / sizeof(float); i++) {
-        double value = VOLUME * sin(g_step_num * g_step_size);
-        fstream[i] = (float) value;
-        g_step_num++;
-    }
+    chip8_read_sound(userdata, (float *) stream, len / sizeof(float));
 }
 
+// The device runs from here on, silence is just an empty ring
 int chip8_init_audio(struct chip8_audio *audio, const struct chip8_config *config) {
-    (void) config;
-
-    g_frequency = 500;
-    g_step_size = 2.0 * M_PI * (double) g_frequency / (double) SAMPLE_RATE;
+    chip8_init_tone(&audio->tone, config->waveform, SOUND_FREQUENCY, SOUND_SAMPLE_RATE, SOUND_VOLUME);
+    chip8_init_sound_ring(&audio->ring);
+    audio->low_latency = config->low_latency_audio;
 
     SDL_AudioSpec spec = {
-        .freq = SAMPLE_RATE,
+        .freq = SOUND_SAMPLE_RATE,
         .format = AUDIO_F32,
         .channels = 1,
-        .samples = NUM_SAMPLES,
+        .samples = audio->low_latency ? SOUND_LOW_LATENCY_SAMPLES : NUM_SAMPLES,
         .callback = audio_callback,
+        .userdata = &audio->ring,
     };
 
-    audio->audio_device = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, SDL_AUDIO_ALLOW_ANY_CHANGE);
+    // The rate control counts in samples at SOUND_SAMPLE_RATE, so in low latency mode only the buffer size may change
+    int allowed_changes = audio->low_latency ? SDL_AUDIO_ALLOW_SAMPLES_CHANGE : SDL_AUDIO_ALLOW_ANY_CHANGE;
+    audio->audio_device = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, allowed_changes);
     if (audio->audio_device == 0) {
         fprintf(stderr, "SDL_OpenAudioDevice(): %s\n", SDL_GetError());
         return -1;
     }
 
+    if (audio->low_latency) {
+        chip8_init_rate_control(&audio->rate, &audio->ring);
+    }
+    SDL_PauseAudioDevice(audio->audio_device, 0);
     return 0;
 }
 
@@ -58,24 +49,13 @@ int chip8_close_audio(struct chip8_audio *audio, const struct chip8_config *conf
     return 0;
 }
 
-int chip8_play_audio(struct chip8_audio *audio, const struct chip8_config *config) {
-    (void) config;
-
-    SDL_PauseAudioDevice(audio->audio_device, 0);
-    return 0;
-}
-
-int chip8_pause_audio(struct chip8_audio *audio, const struct chip8_config *config) {
+// Queue the sound of the frame that just ran, called once per emulated frame
+int chip8_update_audio(struct chip8_audio *audio, const struct chip8_state *state, const struct chip8_config *config) {
     (void) config;
 
-    SDL_PauseAudioDevice(audio->audio_device, 1);
+    float samples[SOUND_MAX_FRAME_SAMPLES];
+    size_t count = audio->low_latency ? chip8_pace_sound(&audio->rate, &audio->ring) : SOUND_FRAME_SAMPLES;
+    chip8_generate_sound(&audio->tone, state, samples, count);
+    chip8_write_sound(&audio->ring, samples, count);
     return 0;
 }
-
-int chip8_update_audio(struct chip8_audio *audio, const struct chip8_state *state, const struct chip8_config *config) {
-    if (state->sound_timer > 0) {
-        return chip8_play_audio(audio, config);
-    } else {
-        return chip8_pause_audio(audio, config);
-    }
-}
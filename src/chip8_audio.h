@@ -3,8 +3,18 @@
 
 #include <SDL2/SDL.h>
 
+#include "chip8_sound.h"
+
 struct chip8_audio {
     SDL_AudioDeviceID audio_device;
+
+    // The emulation thread generates the tone into the ring, the audio callback plays it out
+    struct chip8_tone tone;
+    struct chip8_sound_ring ring;
+
+    // Only used in low latency mode, otherwise every frame is exactly SOUND_FRAME_SAMPLES
+    bool low_latency;
+    struct chip8_rate_control rate;
 };
 
 #include "chip8_config.h"
@@ -13,8 +23,6 @@ struct chip8_audio {
 int chip8_init_audio(struct chip8_audio *audio, const struct chip8_config *config);
 int chip8_close_audio(struct chip8_audio *audio, const struct chip8_config *config);
 
-int chip8_play_audio(struct chip8_audio *audio, const struct chip8_config *config);
-int chip8_pause_audio(struct chip8_audio *audio, const struct chip8_config *config);
 int chip8_update_audio(struct chip8_audio *audio, const struct chip8_state *state, const struct chip8_config *config);
 
 #endif // CHIP8_AUDIO_H
@@ -1,9 +1,34 @@
 #ifndef CHIP8_CONFIG_H
 #define CHIP8_CONFIG_H
 
+#include <stdbool.h>
+
+enum chip8_waveform {
+    WAVE_SINE,
+    WAVE_SQUARE,
+    WAVE_TRIANGLE
+};
+
 struct chip8_config {
+    // Instructions per second, spread evenly over the 60 frames of each second
     int target_speed;
     int default_scale;
+
+    // Run unthrottled from the start, toggled with Tab
+    bool turbo;
+    // In turbo mode present every Nth emulated frame, or once per 1/60 s of wall-clock time if 0
+    int turbo_frame_skip;
+
+    // Shape of the beeper tone
+    enum chip8_waveform waveform;
+    // Small audio buffer whose depth and rate adapt to the device, see chip8_rate_control
+    bool low_latency_audio;
+
+    // Let lit pixels fade out instead of vanishing, see chip8_phosphor
+    bool phosphor;
+
+    // Stop after this many emulated frames, or run until quit if 0
+    int max_frames;
 };
 
 int chip8_load_config(const char *file, struct chip8_config *config);
@@ -1,18 +1,38 @@
 #ifndef CHIP8_DISPLAY_H
 #define CHIP8_DISPLAY_H
 
-#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-struct chip8_display {
-    SDL_Renderer *renderer;
-    SDL_Window *window;
+#include "chip8_config.h"
+#include "chip8_frame.h"
+
+// What the user asked for since the last poll
+struct chip8_input {
+    // Bit n is set while key n is held
+    uint16_t keys;
+    bool toggle_pause;
+    bool toggle_turbo;
+    bool quit;
 };
 
-#include "chip8_config.h"
-#include "chip8_state.h"
+typedef int (*chip8_frame_callback)(const struct chip8_frame *frame, void *data);
+
+// Backends fill in whichever operations they need, a display with none of them is headless
+struct chip8_display {
+    int (*update)(struct chip8_display *display, const struct chip8_frame *frame, const struct chip8_config *config);
+    int (*poll)(struct chip8_display *display, struct chip8_input *input, const struct chip8_config *config);
+    int (*close)(struct chip8_display *display, const struct chip8_config *config);
+    void *backend;
+
+    // Optional, sees every new frame the display is handed
+    chip8_frame_callback on_frame;
+    void *on_frame_data;
+};
 
-int chip8_init_display(struct chip8_display *display, const struct chip8_config *config);
+int chip8_init_headless_display(struct chip8_display *display, const struct chip8_config *config);
 int chip8_close_display(struct chip8_display *display, const struct chip8_config *config);
-int chip8_update_display(struct chip8_display *display, struct chip8_state *state, const struct chip8_config *config);
+int chip8_update_display(struct chip8_display *display, const struct chip8_frame *frame, const struct chip8_config *config);
+int chip8_poll_display(struct chip8_display *display, struct chip8_input *input, const struct chip8_config *config);
 
 #endif // CHIP8_DISPLAY_H
@@ -1,105 +1,188 @@
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "chip8_analysis.h"
 #include "chip8_config.h"
 #include "chip8_exec.h"
 #include "chip8_state.h"
 
-static int chip8_exec_unknown(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+static int chip8_exec_unknown(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) state;
     (void) config;
     
-    fprintf(stderr, "unknown opcode 0x%04"PRIx16" at pc 0x%04"PRIx16"\n", opcode, state->pc);
+    fprintf(stderr, "unknown opcode 0x%04"PRIx16" at pc 0x%04"PRIx16"\n", inst->opcode, state->pc);
     return -1;
 }
 
-// Scroll up by N pixels (N/2 in low-resolution mode)
-static int chip8_exec_00BN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+// Mark count screen rows starting at y as changed
+static void chip8_mark_dirty(struct chip8_state *state, uint8_t y, uint8_t count) {
+    uint64_t rows = (count >= 64) ? UINT64_MAX : (UINT64_C(1) << count) - 1;
+    state->dirty_rows |= rows << y;
+}
+
+// Whether plane 0 can stay on the lores plane for an operation, it is expanded to the hires rows otherwise
+static bool chip8_use_lores_plane(struct chip8_state *state, bool representable) {
+    if (state->lores_native && (state->hires || !representable)) {
+        chip8_expand_lores(state);
+    }
+    return state->lores_native;
+}
+
+// Scroll the selected planes up by N pixels (N/2 in low-resolution mode)
+int chip8_exec_00BN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
 
-    uint8_t N = get_n(opcode);
+    uint8_t N = inst->n;
+
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++) {
+        if (!(state->planes & (1 << plane))) {
+            continue;
+        }
+
+        // An odd scroll would split the 2x2 lores pixels
+        if (plane == 0 && chip8_use_lores_plane(state, N % 2 == 0)) {
+            memmove(state->lores_screen, &state->lores_screen[N / 2], (DISPLAY_HEIGHT - N) / 2 * sizeof(uint64_t));
+            memset(&state->lores_screen[(DISPLAY_HEIGHT - N) / 2], 0, N / 2 * sizeof(uint64_t));
+            continue;
+        }
 
-    memmove(state->screen, &state->screen[N * DISPLAY_WIDTH / 8], (DISPLAY_HEIGHT - N) * DISPLAY_WIDTH / 8);
-    memset(&state->screen[(DISPLAY_HEIGHT - N) * DISPLAY_WIDTH / 8], 0, N * DISPLAY_WIDTH / 8);
+        state->screen_origin[plane] = (state->screen_origin[plane] + N) % DISPLAY_HEIGHT;
+        for (uint8_t y = DISPLAY_HEIGHT - N; y < DISPLAY_HEIGHT; y++) {
+            chip8_plane_row(state, plane, y) = 0;
+        }
+    }
+    if (N > 0 && state->planes != 0) {
+        state->dirty_rows = UINT64_MAX;
+    }
 
     state->pc += 2;
     return 0;
 }
 
-// Scroll down by N pixels (N/2 in low-resolution mode)
-static int chip8_exec_00CN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+// Scroll the selected planes down by N pixels (N/2 in low-resolution mode)
+int chip8_exec_00CN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
 
-    uint8_t N = get_n(opcode);
+    uint8_t N = inst->n;
+
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++) {
+        if (!(state->planes & (1 << plane))) {
+            continue;
+        }
+
+        if (plane == 0 && chip8_use_lores_plane(state, N % 2 == 0)) {
+            memmove(&state->lores_screen[N / 2], state->lores_screen, (DISPLAY_HEIGHT - N) / 2 * sizeof(uint64_t));
+            memset(state->lores_screen, 0, N / 2 * sizeof(uint64_t));
+            continue;
+        }
 
-    memmove(&state->screen[N * DISPLAY_WIDTH / 8], state->screen, (DISPLAY_HEIGHT - N) * DISPLAY_WIDTH / 8);
-    memset(state->screen, 0, N * DISPLAY_WIDTH / 8);
+        state->screen_origin[plane] = (state->screen_origin[plane] + DISPLAY_HEIGHT - N) % DISPLAY_HEIGHT;
+        for (uint8_t y = 0; y < N; y++) {
+            chip8_plane_row(state, plane, y) = 0;
+        }
+    }
+    if (N > 0 && state->planes != 0) {
+        state->dirty_rows = UINT64_MAX;
+    }
 
     state->pc += 2;
     return 0;
 }
 
 // Scroll up by N pixels (N/2 in low-resolution mode)
-static int chip8_exec_00DN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
-    return chip8_exec_00BN(state, config, opcode);
+int chip8_exec_00DN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
+    return chip8_exec_00BN(state, config, inst);
 }
 
-// Clear the screen
-static int chip8_exec_00E0(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+// Clear the selected planes
+int chip8_exec_00E0(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
-    (void) opcode;
+    (void) inst;
     
-    memset(state->screen, 0, sizeof(state->screen));
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++) {
+        if (!(state->planes & (1 << plane))) {
+            continue;
+        }
+
+        memset(state->screen[plane], 0, sizeof(state->screen[plane]));
+        state->screen_origin[plane] = 0;
+        if (plane == 0) {
+            memset(state->lores_screen, 0, sizeof(state->lores_screen));
+            state->lores_native = !state->hires;
+        }
+    }
+    state->dirty_rows = UINT64_MAX;
     state->pc += 2;
     return 0;
 }
 
 // Return from subroutine
-static int chip8_exec_00EE(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
-    (void) opcode;
+int chip8_exec_00EE(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
+    (void) inst;
 
     return chip8_stack_pop(state, config, &state->pc);
 }
 
-// Scroll right by 4 pixels (2 in low-resolution mode)
-static int chip8_exec_00FB(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+// Scroll the selected planes right by 4 pixels (2 in low-resolution mode)
+int chip8_exec_00FB(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
-    (void) opcode;
+    (void) inst;
 
-    for (uint8_t i = 0; i < DISPLAY_HEIGHT; i++) {
-        for (uint8_t j = DISPLAY_WIDTH / 8 - 1; j >= 1; j--) {
-            uint16_t index = i * DISPLAY_WIDTH / 8 + j;
-            state->screen[index] = (state->screen[index] >> 4) | (state->screen[index - 1] << 4);
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++) {
+        if (!(state->planes & (1 << plane))) {
+            continue;
+        }
+
+        if (plane == 0 && chip8_use_lores_plane(state, true)) {
+            for (uint8_t i = 0; i < DISPLAY_HEIGHT / 2; i++) {
+                state->lores_screen[i] >>= 2;
+            }
+            continue;
+        }
+
+        for (uint8_t i = 0; i < DISPLAY_HEIGHT; i++) {
+            state->screen[plane][i] >>= 4;
         }
-        state->screen[i * DISPLAY_WIDTH / 8] >>= 4;
     }
+    state->dirty_rows = UINT64_MAX;
     state->pc += 2;
     return 0;
 }
 
-// Scroll left by 4 pixels (2 in low-resolution mode)
-static int chip8_exec_00FC(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+// Scroll the selected planes left by 4 pixels (2 in low-resolution mode)
+int chip8_exec_00FC(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
-    (void) opcode;
+    (void) inst;
     
-    for (uint8_t i = 0; i < DISPLAY_HEIGHT; i++) {
-        for (uint8_t j = 0; j < DISPLAY_WIDTH / 8 - 1; j++) {
-            uint16_t index = i * DISPLAY_WIDTH / 8 + j;
-            state->screen[index] = (state->screen[index] << 4) | (state->screen[index + 1] >> 4);
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++) {
+        if (!(state->planes & (1 << plane))) {
+            continue;
+        }
+
+        if (plane == 0 && chip8_use_lores_plane(state, true)) {
+            for (uint8_t i = 0; i < DISPLAY_HEIGHT / 2; i++) {
+                state->lores_screen[i] <<= 2;
+            }
+            continue;
+        }
+
+        for (uint8_t i = 0; i < DISPLAY_HEIGHT; i++) {
+            state->screen[plane][i] <<= 4;
         }
-        state->screen[(i + 1) * DISPLAY_WIDTH / 8 - 1] <<= 4;
     }
+    state->dirty_rows = UINT64_MAX;
     state->pc += 2;
     return 0;
 }
 
 // Exit interpreter
-static int chip8_exec_00FD(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_00FD(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
-    (void) opcode;
+    (void) inst;
 
     state->stopped = true;
     state->pc += 2;
@@ -107,53 +190,55 @@ static int chip8_exec_00FD(struct chip8_state *state, const struct chip8_config
 }
 
 // Disable high-resolution
-static int chip8_exec_00FE(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_00FE(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
-    (void) opcode;
+    (void) inst;
 
     state->hires = false;
+    chip8_compact_lores(state);
     state->pc += 2;
     return 0;
 }
 
 // Enable high-resolution
-static int chip8_exec_00FF(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_00FF(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
-    (void) opcode;
+    (void) inst;
 
+    chip8_expand_lores(state);
     state->hires = true;
     state->pc += 2;
     return 0;
 }
 
 // Jump to address NNN
-static int chip8_exec_1NNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_1NNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint16_t NNN = get_nnn(opcode);
+    uint16_t NNN = inst->nnn;
     state->pc = NNN;
     return 0;
 }
 
 // Call subroutine at address NNN
-static int chip8_exec_2NNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_2NNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
     if (chip8_stack_push(state, config, state->pc + 2) == -1) {
         return -1;
     }
 
-    uint16_t NNN = get_nnn(opcode);
+    uint16_t NNN = inst->nnn;
     state->pc = NNN;
     return 0;
 }
 
 // Skip the next instruction if Vx == NN
-static int chip8_exec_3XNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_3XNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint16_t NN = get_nn(opcode);
+    uint8_t x = inst->x;
+    uint16_t NN = inst->nn;
 
     if (state->registers[x] == NN) {
         state->pc += 2;
@@ -163,11 +248,11 @@ static int chip8_exec_3XNN(struct chip8_state *state, const struct chip8_config
 }
 
 // Skip the next instruction if Vx != NN
-static int chip8_exec_4XNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_4XNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint16_t NN = get_nn(opcode);
+    uint8_t x = inst->x;
+    uint16_t NN = inst->nn;
 
     if (state->registers[x] != NN) {
         state->pc += 2;
@@ -177,11 +262,11 @@ static int chip8_exec_4XNN(struct chip8_state *state, const struct chip8_config
 }
 
 // Skip the next instruction if Vx == Vy
-static int chip8_exec_5XY0(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_5XY0(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
 
     if (state->registers[x] == state->registers[y]) {
         state->pc += 2;
@@ -191,11 +276,11 @@ static int chip8_exec_5XY0(struct chip8_state *state, const struct chip8_config
 }
 
 // Set Vx = NN
-static int chip8_exec_6XNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_6XNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint16_t NN = get_nn(opcode);
+    uint8_t x = inst->x;
+    uint16_t NN = inst->nn;
 
     state->registers[x] = NN;
     state->pc += 2;
@@ -203,11 +288,11 @@ static int chip8_exec_6XNN(struct chip8_state *state, const struct chip8_config
 }
 
 // Set Vx = Vx + NN
-static int chip8_exec_7XNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_7XNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint16_t NN = get_nn(opcode);
+    uint8_t x = inst->x;
+    uint16_t NN = inst->nn;
 
     state->registers[x] += NN;
     state->pc += 2;
@@ -215,11 +300,11 @@ static int chip8_exec_7XNN(struct chip8_state *state, const struct chip8_config
 }
 
 // Set Vx = Vy
-static int chip8_exec_8XY0(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY0(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
     
     state->registers[x] = state->registers[y];
     state->pc += 2;
@@ -227,11 +312,11 @@ static int chip8_exec_8XY0(struct chip8_state *state, const struct chip8_config
 }
 
 // Set Vx = Vx | Vy
-static int chip8_exec_8XY1(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY1(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
     
     state->registers[x] |= state->registers[y];
     state->pc += 2;
@@ -239,11 +324,11 @@ static int chip8_exec_8XY1(struct chip8_state *state, const struct chip8_config
 }
 
 // Set Vx = Vx & Vy
-static int chip8_exec_8XY2(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY2(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
     
     state->registers[x] &= state->registers[y];
     state->pc += 2;
@@ -251,11 +336,11 @@ static int chip8_exec_8XY2(struct chip8_state *state, const struct chip8_config
 }
 
 // Set Vx = Vx ^ Vy
-static int chip8_exec_8XY3(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY3(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
     
     state->registers[x] ^= state->registers[y];
     state->pc += 2;
@@ -264,11 +349,11 @@ static int chip8_exec_8XY3(struct chip8_state *state, const struct chip8_config
 
 // Set Vx = Vx + Vy
 // Set VF = 1 if the operation overflows and 0 otherwise
-static int chip8_exec_8XY4(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY4(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
     uint8_t VF = (state->registers[x] > UINT8_MAX - state->registers[y]);
     
     state->registers[x] += state->registers[y];
@@ -279,11 +364,11 @@ static int chip8_exec_8XY4(struct chip8_state *state, const struct chip8_config
 
 // Set Vx = Vx - Vy
 // Set VF = 0 if the operation underflows and 1 otherwise
-static int chip8_exec_8XY5(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY5(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
     uint8_t VF = (state->registers[x] >= state->registers[y]);
     
     state->registers[x] -= state->registers[y];
@@ -294,10 +379,10 @@ static int chip8_exec_8XY5(struct chip8_state *state, const struct chip8_config
 
 // Set Vx = Vx >> 1 or Vy >> 1 depending on configuration
 // Set VF to the lowest bit of Vx or Vy
-static int chip8_exec_8XY6(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY6(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     uint8_t VF = (state->registers[x] & 1);
 
     state->registers[x] >>= 1;
@@ -308,11 +393,11 @@ static int chip8_exec_8XY6(struct chip8_state *state, const struct chip8_config
 
 // Set Vx = Vy - Vx
 // Set VF = 0 if the operation underflows and 1 otherwise
-static int chip8_exec_8XY7(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XY7(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
     uint8_t VF = (state->registers[y] >= state->registers[x]);
 
     state->registers[x] = state->registers[y] - state->registers[x];
@@ -323,10 +408,10 @@ static int chip8_exec_8XY7(struct chip8_state *state, const struct chip8_config
 
 // Set Vx = Vx << 1 or Vy << 1 depending on configuration
 // Set VF to the highest bit of Vx or Vy
-static int chip8_exec_8XYE(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_8XYE(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     uint8_t VF = (state->registers[x] >> 7);
 
     state->registers[x] <<= 1;
@@ -336,11 +421,11 @@ static int chip8_exec_8XYE(struct chip8_state *state, const struct chip8_config
 }
 
 // Skip the next instruction if Vx != Vy
-static int chip8_exec_9XY0(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_9XY0(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t y = get_y(opcode);
+    uint8_t x = inst->x;
+    uint8_t y = inst->y;
 
     if (state->registers[x] != state->registers[y]) {
         state->pc += 2;
@@ -350,10 +435,10 @@ static int chip8_exec_9XY0(struct chip8_state *state, const struct chip8_config
 }
 
 // Set I = NNN
-static int chip8_exec_ANNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_ANNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint16_t NNN = get_nnn(opcode);
+    uint16_t NNN = inst->nnn;
 
     state->index_register = NNN;
     state->pc += 2;
@@ -361,28 +446,29 @@ static int chip8_exec_ANNN(struct chip8_state *state, const struct chip8_config
 }
 
 // Jump to address V0 + XNN or Vx + XNN depending on configuration
-static int chip8_exec_BXNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_BXNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
     uint8_t V0 = state->registers[0];
-    uint16_t NNN = get_nnn(opcode);
+    uint16_t NNN = inst->nnn;
 
     state->pc = V0 + NNN;
     return 0;
 }
 
 // Set Vx = NN & random number
-static int chip8_exec_CXNN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_CXNN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
-    uint8_t NN = get_nn(opcode);
+    uint8_t x = inst->x;
+    uint8_t NN = inst->nn;
 
-    state->registers[x] = rand() & NN;
+    state->registers[x] = chip8_random(state) & NN;
     state->pc += 2;
     return 0;
 }
 
+// Each lores pixel is two hires pixels wide
 static const uint8_t lores_lookup[] = {
     0x00, 0x03, 0x0C, 0x0F,
     0x30, 0x33, 0x3C, 0x3F,
@@ -390,47 +476,78 @@ static const uint8_t lores_lookup[] = {
     0xF0, 0xF3, 0xFC, 0xFF
 };
 
-// Helper function to draw a single byte (8x1 block)
-static void chip8_apply_mask(struct chip8_state *state, uint8_t x_bytes, uint8_t x_bits, uint8_t y, uint8_t mask) {
-    uint16_t index = (DISPLAY_WIDTH / 8) * y + x_bytes;
-
-    uint8_t prev;
-    if (x_bits == 0) {
-        prev = state->screen[index];
-        state->screen[index] ^= mask;
-    } else {
-        uint8_t prev1 = state->screen[index] << x_bits;
-        state->screen[index] ^= (mask >> x_bits);
-
-        uint8_t prev2 = 0;
-        if (x_bytes < DISPLAY_WIDTH / 8 - 1) {
-            prev2 = state->screen[index + 1] >> (8 - x_bits);
-            state->screen[index + 1] ^= (mask << (8 - x_bits));
-        }
+// Draw a lores sprite at native resolution on the lores plane, the display doubles it
+static bool chip8_draw_lores(struct chip8_state *state, const struct chip8_instruction *inst, uint16_t address) {
+    uint8_t Vx = state->registers[inst->x] % (DISPLAY_WIDTH / 2);
+    uint8_t Vy = state->registers[inst->y] % (DISPLAY_HEIGHT / 2);
+    uint8_t y_limit = (inst->n > DISPLAY_HEIGHT / 2 - Vy) ? DISPLAY_HEIGHT / 2 - Vy : inst->n;
 
-        prev = prev1 | prev2;
+    uint64_t collision = 0;
+    for (uint8_t j = 0; j < y_limit; j++) {
+        uint64_t word = (uint64_t) state->memory[(address + j) & 0xFFF] << 56 >> Vx;
+        collision |= state->lores_screen[Vy + j] & word;
+        state->lores_screen[Vy + j] ^= word;
     }
 
-    if (~(prev ^ mask) & prev) {
-        state->registers[0xF] = 1;
+    chip8_mark_dirty(state, 2 * Vy, 2 * y_limit);
+    return collision != 0;
+}
+
+// Draw a sprite on the hires rows of a plane, doubled in lores
+static bool chip8_draw_rows(struct chip8_state *state, uint8_t plane, const struct chip8_instruction *inst, uint16_t address) {
+    uint8_t scale = state->hires ? 1 : 2;
+
+    uint8_t Vx = (scale * state->registers[inst->x]) % DISPLAY_WIDTH;
+    uint8_t Vy = (scale * state->registers[inst->y]) % DISPLAY_HEIGHT;
+
+    uint8_t N = inst->n;
+
+    bool wide = (N == 0 && state->hires);
+    uint8_t rows = wide ? 16 : N;
+    uint8_t y_limit = (rows * scale > DISPLAY_HEIGHT - Vy) ? (DISPLAY_HEIGHT - Vy) / scale : rows;
+
+    // Each sprite row is shifted into place as a whole screen row, pixels past the right edge fall off the end
+    uint8_t width = wide ? 16 : 8 * scale;
+    chip8_row collision = 0;
+
+    for (uint8_t j = 0; j < y_limit; j++) {
+        uint16_t sprite;
+        if (wide) {
+            sprite = state->memory[(address + 2 * j) & 0xFFF] << 8 | state->memory[(address + 2 * j + 1) & 0xFFF];
+        } else if (state->hires) {
+            sprite = state->memory[(address + j) & 0xFFF];
+        } else {
+            uint8_t mask = state->memory[(address + j) & 0xFFF];
+            sprite = lores_lookup[mask >> 4] << 8 | lores_lookup[mask & 0xF];
+        }
+
+        chip8_row word = ((chip8_row) sprite << (DISPLAY_WIDTH - width)) >> Vx;
+        for (uint8_t k = 0; k < scale; k++) {
+            chip8_row *row = &chip8_plane_row(state, plane, Vy + scale * j + k);
+            collision |= *row & word;
+            *row ^= word;
+        }
     }
+
+    chip8_mark_dirty(state, Vy, y_limit * scale);
+    return collision != 0;
 }
 
-// Draw 8xN sprite (16x16 in hires if N = 0) located at I to display coordinates (Vx, Vy)
+// Draw 8xN sprite (16x16 in hires if N = 0) located at I to display coordinates (Vx, Vy) on each selected plane
 // Set VF = 1 if any pixels are flipped from set to unset and 0 otherwise
 // The sprite is wrapped around if the coordinates are offscreen and clipped if they are near the edge
-static int chip8_exec_DXYN(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_DXYN(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
 
     // const uint8_t w = DISPLAY_WIDTH / 2;
     // const uint8_t h = DISPLAY_HEIGHT / 2;
 
-    // uint8_t Vx = state->registers[get_x(opcode)] % w;
-    // uint8_t Vy = state->registers[get_y(opcode)] % h;
+    // uint8_t Vx = state->registers[inst->x] % w;
+    // uint8_t Vy = state->registers[inst->y] % h;
 
     // uint8_t Vx_bytes = Vx / 8;
     // uint8_t Vx_bits = Vx % 8;
-    // uint8_t n = get_n(opcode);
+    // uint8_t n = inst->n;
     // uint8_t limit = (n > h - Vy) ? h - Vy : n;
 
     // state->registers[0xF] = 0;
@@ -463,50 +580,35 @@ static int chip8_exec_DXYN(struct chip8_state *state, const struct chip8_config
     //     }
     // }
 
-    uint8_t scale = state->hires ? 1 : 2;
-
-    uint8_t Vx = (scale * state->registers[get_x(opcode)]) % DISPLAY_WIDTH;
-    uint8_t Vy = (scale * state->registers[get_y(opcode)]) % DISPLAY_HEIGHT;
+    uint8_t N = inst->n;
+    uint8_t size = (N == 0 && state->hires) ? 32 : N;
+    uint16_t address = state->index_register;
+    bool collision = false;
 
-    uint8_t Vx_bytes = Vx / 8;
-    uint8_t Vx_bits = Vx % 8;
-
-    uint8_t N = get_n(opcode);
-
-    uint8_t cols = (N == 0 && state->hires) ? 16 : 8;
-    uint8_t rows = (N == 0 && state->hires) ? 16 : N;
-
-    uint8_t x_limit = (cols * scale > DISPLAY_WIDTH - Vx) ? (DISPLAY_WIDTH - Vx) / scale : cols;
-    cols /= 8;
-    x_limit = (x_limit + 7) / 8;
-    uint8_t y_limit = (rows * scale > DISPLAY_HEIGHT - Vy) ? (DISPLAY_HEIGHT - Vy) / scale : rows;
-
-    state->registers[0xF] = 0;
-
-    for (uint8_t j = 0; j < y_limit; j++) {
-        for (uint8_t i = 0; i < x_limit; i++) {
-            uint8_t mask = state->memory[state->index_register + j * cols + i];
+    // With both planes selected, the second plane's sprite follows the first's in memory
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++) {
+        if (!(state->planes & (1 << plane))) {
+            continue;
+        }
 
-            if (state->hires) {
-                chip8_apply_mask(state, Vx_bytes + i, Vx_bits, Vy + j, mask);
-            } else {
-                chip8_apply_mask(state, Vx_bytes + 2 * i,     Vx_bits, Vy + 2 * j,     lores_lookup[mask >> 4]);
-                chip8_apply_mask(state, Vx_bytes + 2 * i + 1, Vx_bits, Vy + 2 * j,     lores_lookup[mask & 0xF]);
-                chip8_apply_mask(state, Vx_bytes + 2 * i,     Vx_bits, Vy + 2 * j + 1, lores_lookup[mask >> 4]);
-                chip8_apply_mask(state, Vx_bytes + 2 * i + 1, Vx_bits, Vy + 2 * j + 1, lores_lookup[mask & 0xF]);
-            }
+        if (plane == 0 && chip8_use_lores_plane(state, true)) {
+            collision |= chip8_draw_lores(state, inst, address);
+        } else {
+            collision |= chip8_draw_rows(state, plane, inst, address);
         }
+        address += size;
     }
 
+    state->registers[0xF] = collision;
     state->pc += 2;
     return 0;
 }
 
 // Skip the next instruction if the key stored in Vx is pressed
-static int chip8_exec_EX9E(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_EX9E(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     uint8_t Vx = state->registers[x];
     uint8_t key = Vx & 0xF;
 
@@ -518,10 +620,10 @@ static int chip8_exec_EX9E(struct chip8_state *state, const struct chip8_config
 }
 
 // Skip the next instruction if the key stored in Vx is not pressed
-static int chip8_exec_EXA1(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_EXA1(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     uint8_t Vx = state->registers[x];
     uint8_t key = Vx & 0xF;
 
@@ -532,11 +634,36 @@ static int chip8_exec_EXA1(struct chip8_state *state, const struct chip8_config
     return 0;
 }
 
+// Select the planes that drawing, scrolling and clearing apply to (XO-CHIP)
+int chip8_exec_FN01(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
+    (void) config;
+
+    state->planes = inst->x & ((1 << SCREEN_PLANES) - 1);
+    if (state->planes & 2) {
+        state->multi_plane = true;
+    }
+    state->pc += 2;
+    return 0;
+}
+
+// Load the 16 byte audio pattern from I (XO-CHIP)
+int chip8_exec_F002(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
+    (void) config;
+    (void) inst;
+
+    for (uint8_t i = 0; i < sizeof(state->audio_pattern); i++) {
+        state->audio_pattern[i] = state->memory[(state->index_register + i) & 0xFFF];
+    }
+    state->has_pattern = true;
+    state->pc += 2;
+    return 0;
+}
+
 // Set Vx to the value of the delay timer
-static int chip8_exec_FX07(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX07(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
 
     state->registers[x] = state->delay_timer;
     state->pc += 2;
@@ -544,10 +671,10 @@ static int chip8_exec_FX07(struct chip8_state *state, const struct chip8_config
 }
 
 // Wait for the next key press and store the pressed key in Vx
-static int chip8_exec_FX0A(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX0A(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     for (int i = 0; i < 16; i++) {
         if (state->keys[i]) {
             state->registers[x] = i;
@@ -560,21 +687,27 @@ static int chip8_exec_FX0A(struct chip8_state *state, const struct chip8_config
 }
 
 // Set the delay timer to Vx
-static int chip8_exec_FX15(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX15(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
 
     state->delay_timer = state->registers[x];
     state->pc += 2;
     return 0;
 }
 
-// Set the sound timer to Vx
-static int chip8_exec_FX18(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+// Set the sound timer to Vx, noting where in the frame the beeper starts or stops
+int chip8_exec_FX18(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
+
+    bool on = state->registers[x] > 0;
+    if (state->num_sound_edges > 0 && on != (state->sound_timer > 0)) {
+        uint8_t edge = (state->num_sound_edges < SOUND_MAX_EDGES) ? state->num_sound_edges++ : SOUND_MAX_EDGES - 1;
+        state->sound_edges[edge] = (struct chip8_sound_edge) {state->batch_clock, on};
+    }
 
     state->sound_timer = state->registers[x];
     state->pc += 2;
@@ -582,10 +715,10 @@ static int chip8_exec_FX18(struct chip8_state *state, const struct chip8_config
 }
 
 // Set I = I + Vx
-static int chip8_exec_FX1E(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX1E(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
 
     state->index_register += state->registers[x];
     state->index_register &= 0xFFF;
@@ -594,10 +727,10 @@ static int chip8_exec_FX1E(struct chip8_state *state, const struct chip8_config
 }
 
 // Set I to the location of the 5-byte sprite for the character in Vx
-static int chip8_exec_FX29(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX29(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     uint8_t Vx = state->registers[x];
     uint8_t ch = Vx & 0xF;
 
@@ -607,10 +740,10 @@ static int chip8_exec_FX29(struct chip8_state *state, const struct chip8_config
 }
 
 // Set I to the location of the 10-byte sprite for the character in Vx
-static int chip8_exec_FX30(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX30(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     uint8_t Vx = state->registers[x];
     uint8_t ch = Vx & 0xF;
 
@@ -620,38 +753,52 @@ static int chip8_exec_FX30(struct chip8_state *state, const struct chip8_config
 }
 
 // Store the binary-coded decimal representation of Vx at I
-static int chip8_exec_FX33(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX33(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     uint8_t Vx = state->registers[x];
     for (int i = 2; i >= 0; i--) {
-        state->memory[state->index_register + i] = Vx % 10;
+        state->memory[(state->index_register + i) & 0xFFF] = Vx % 10;
         Vx /= 10;
     }
+    chip8_invalidate_decoded(state, state->index_register, 3);
+
+    state->pc += 2;
+    return 0;
+}
+
+// Set the audio pattern playback pitch to Vx (XO-CHIP)
+int chip8_exec_FX3A(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
+    (void) config;
 
+    state->pitch = state->registers[inst->x];
     state->pc += 2;
     return 0;
 }
 
 // Store the registers V0 to Vx in memory starting from I
 // May increase I by x + 1 depending on configuration
-static int chip8_exec_FX55(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX55(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
+
+    for (uint8_t i = 0; i <= x; i++) {
+        state->memory[(state->index_register + i) & 0xFFF] = state->registers[i];
+    }
+    chip8_invalidate_decoded(state, state->index_register, x + 1);
 
-    memcpy(&state->memory[state->index_register], state->registers, (x + 1) * sizeof(*state->registers));
     state->pc += 2;
     return 0;
 }
 
 // Read the registers V0 to Vx from memory starting at I
 // May increase I by x + 1 depending on configuration
-static int chip8_exec_FX65(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX65(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
     
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     
     memcpy(state->registers, &state->memory[state->index_register], (x + 1) * sizeof(*state->registers));
     state->pc += 2;
@@ -659,102 +806,252 @@ static int chip8_exec_FX65(struct chip8_state *state, const struct chip8_config
 }
 
 // Store registers V0 to Vx in RPL user flags
-static int chip8_exec_FX75(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX75(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
 
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     memcpy(state->rpl_flags, state->registers, x + 1);
     state->pc += 2;
     return 0;
 }
 
 // Read registers V0 to Vx from RPL user flags
-static int chip8_exec_FX85(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+int chip8_exec_FX85(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst) {
     (void) config;
 
-    uint8_t x = get_x(opcode);
+    uint8_t x = inst->x;
     memcpy(state->registers, state->rpl_flags, x + 1);
     state->pc += 2;
     return 0;
 }
 
-int chip8_exec(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+#define handler_entry(name) [CHIP8_OP_##name] = chip8_exec_##name,
+
+static chip8_handler *const chip8_handlers[] = {
+    [CHIP8_OP_UNKNOWN] = chip8_exec_unknown,
+    CHIP8_OPS(handler_entry)
+};
+
+static enum chip8_op chip8_decode_op(uint16_t opcode) {
     switch (get_h(opcode)) {
         case 0x0:
             switch (get_nnn(opcode) >> 4) {
-                case 0x0B: return chip8_exec_00BN(state, config, opcode);
-                case 0x0C: return chip8_exec_00CN(state, config, opcode);
-                case 0x0D: return chip8_exec_00DN(state, config, opcode);
+                case 0x0B: return CHIP8_OP_00BN;
+                case 0x0C: return CHIP8_OP_00CN;
+                case 0x0D: return CHIP8_OP_00DN;
                 default:
                     switch (get_nn(opcode)) {
-                        case 0xE0: return chip8_exec_00E0(state, config, opcode);
-                        case 0xEE: return chip8_exec_00EE(state, config, opcode);
-                        case 0xFB: return chip8_exec_00FB(state, config, opcode);
-                        case 0xFC: return chip8_exec_00FC(state, config, opcode);
-                        case 0xFD: return chip8_exec_00FD(state, config, opcode);
-                        case 0xFE: return chip8_exec_00FE(state, config, opcode);
-                        case 0xFF: return chip8_exec_00FF(state, config, opcode);
-                        default: return chip8_exec_unknown(state, config, opcode);
+                        case 0xE0: return CHIP8_OP_00E0;
+                        case 0xEE: return CHIP8_OP_00EE;
+                        case 0xFB: return CHIP8_OP_00FB;
+                        case 0xFC: return CHIP8_OP_00FC;
+                        case 0xFD: return CHIP8_OP_00FD;
+                        case 0xFE: return CHIP8_OP_00FE;
+                        case 0xFF: return CHIP8_OP_00FF;
+                        default: return CHIP8_OP_UNKNOWN;
                     }
             }
-        case 0x1: return chip8_exec_1NNN(state, config, opcode);
-        case 0x2: return chip8_exec_2NNN(state, config, opcode);
-        case 0x3: return chip8_exec_3XNN(state, config, opcode);
-        case 0x4: return chip8_exec_4XNN(state, config, opcode);
+        case 0x1: return CHIP8_OP_1NNN;
+        case 0x2: return CHIP8_OP_2NNN;
+        case 0x3: return CHIP8_OP_3XNN;
+        case 0x4: return CHIP8_OP_4XNN;
         case 0x5:
             if (get_n(opcode) == 0) {
-                return chip8_exec_5XY0(state, config, opcode);
+                return CHIP8_OP_5XY0;
             } else {
-                return chip8_exec_unknown(state, config, opcode);
+                return CHIP8_OP_UNKNOWN;
             }
-        case 0x6: return chip8_exec_6XNN(state, config, opcode);
-        case 0x7: return chip8_exec_7XNN(state, config, opcode);
+        case 0x6: return CHIP8_OP_6XNN;
+        case 0x7: return CHIP8_OP_7XNN;
         case 0x8:
             switch (get_n(opcode)) {
-                case 0x0: return chip8_exec_8XY0(state, config, opcode);
-                case 0x1: return chip8_exec_8XY1(state, config, opcode);
-                case 0x2: return chip8_exec_8XY2(state, config, opcode);
-                case 0x3: return chip8_exec_8XY3(state, config, opcode);
-                case 0x4: return chip8_exec_8XY4(state, config, opcode);
-                case 0x5: return chip8_exec_8XY5(state, config, opcode);
-                case 0x6: return chip8_exec_8XY6(state, config, opcode);
-                case 0x7: return chip8_exec_8XY7(state, config, opcode);
-                case 0xE: return chip8_exec_8XYE(state, config, opcode);
-                default: return chip8_exec_unknown(state, config, opcode);
+                case 0x0: return CHIP8_OP_8XY0;
+                case 0x1: return CHIP8_OP_8XY1;
+                case 0x2: return CHIP8_OP_8XY2;
+                case 0x3: return CHIP8_OP_8XY3;
+                case 0x4: return CHIP8_OP_8XY4;
+                case 0x5: return CHIP8_OP_8XY5;
+                case 0x6: return CHIP8_OP_8XY6;
+                case 0x7: return CHIP8_OP_8XY7;
+                case 0xE: return CHIP8_OP_8XYE;
+                default: return CHIP8_OP_UNKNOWN;
             }
         case 0x9:
             if (get_n(opcode) == 0) {
-                return chip8_exec_9XY0(state, config, opcode);
+                return CHIP8_OP_9XY0;
             } else {
-                return chip8_exec_unknown(state, config, opcode);
+                return CHIP8_OP_UNKNOWN;
             }
-        case 0xA: return chip8_exec_ANNN(state, config, opcode);
-        case 0xB: return chip8_exec_BXNN(state, config, opcode);
-        case 0xC: return chip8_exec_CXNN(state, config, opcode);
-        case 0xD: return chip8_exec_DXYN(state, config, opcode);
+        case 0xA: return CHIP8_OP_ANNN;
+        case 0xB: return CHIP8_OP_BXNN;
+        case 0xC: return CHIP8_OP_CXNN;
+        case 0xD: return CHIP8_OP_DXYN;
         case 0xE:
             switch (get_nn(opcode)) {
-                case 0x9E: return chip8_exec_EX9E(state, config, opcode);
-                case 0xA1: return chip8_exec_EXA1(state, config, opcode);
-                default: return chip8_exec_unknown(state, config, opcode);
+                case 0x9E: return CHIP8_OP_EX9E;
+                case 0xA1: return CHIP8_OP_EXA1;
+                default: return CHIP8_OP_UNKNOWN;
             }
         case 0xF:
             switch (get_nn(opcode)) {
-                case 0x07: return chip8_exec_FX07(state, config, opcode);
-                case 0x0A: return chip8_exec_FX0A(state, config, opcode);
-                case 0x15: return chip8_exec_FX15(state, config, opcode);
-                case 0x18: return chip8_exec_FX18(state, config, opcode);
-                case 0x1E: return chip8_exec_FX1E(state, config, opcode);
-                case 0x29: return chip8_exec_FX29(state, config, opcode);
-                case 0x30: return chip8_exec_FX30(state, config, opcode);
-                case 0x33: return chip8_exec_FX33(state, config, opcode);
-                case 0x55: return chip8_exec_FX55(state, config, opcode);
-                case 0x65: return chip8_exec_FX65(state, config, opcode);
-                case 0x75: return chip8_exec_FX75(state, config, opcode);
-                case 0x85: return chip8_exec_FX85(state, config, opcode);
-                default: return chip8_exec_unknown(state, config, opcode);
+                case 0x01: return CHIP8_OP_FN01;
+                case 0x02: return (get_x(opcode) == 0) ? CHIP8_OP_F002 : CHIP8_OP_UNKNOWN;
+                case 0x07: return CHIP8_OP_FX07;
+                case 0x0A: return CHIP8_OP_FX0A;
+                case 0x15: return CHIP8_OP_FX15;
+                case 0x18: return CHIP8_OP_FX18;
+                case 0x1E: return CHIP8_OP_FX1E;
+                case 0x29: return CHIP8_OP_FX29;
+                case 0x30: return CHIP8_OP_FX30;
+                case 0x33: return CHIP8_OP_FX33;
+                case 0x3A: return CHIP8_OP_FX3A;
+                case 0x55: return CHIP8_OP_FX55;
+                case 0x65: return CHIP8_OP_FX65;
+                case 0x75: return CHIP8_OP_FX75;
+                case 0x85: return CHIP8_OP_FX85;
+                default: return CHIP8_OP_UNKNOWN;
             }
     }
 
-    return -1;
+    return CHIP8_OP_UNKNOWN;
 }
+
+void chip8_decode(struct chip8_instruction *inst, uint16_t opcode) {
+    inst->op = chip8_decode_op(opcode);
+    inst->handler = chip8_handlers[inst->op];
+    inst->opcode = opcode;
+    inst->nnn = get_nnn(opcode);
+    inst->x = get_x(opcode);
+    inst->y = get_y(opcode);
+    inst->n = get_n(opcode);
+    inst->nn = get_nn(opcode);
+}
+
+// Return the decoded instruction at pc, decoding it into the cache first if needed
+// Instructions at odd addresses or past the end of memory (after BNNN or 00EE) are rare enough to always decode
+// from scratch, reading memory with the address wrapped
+const struct chip8_instruction *chip8_fetch(struct chip8_state *state, struct chip8_instruction *scratch) {
+    if (state->pc % 2 != 0 || state->pc >= sizeof(state->memory)) {
+        chip8_decode(scratch, (uint16_t) (state->memory[state->pc & 0xFFF] << 8 | state->memory[(state->pc + 1) & 0xFFF]));
+        return scratch;
+    }
+
+    struct chip8_instruction *inst = &state->decoded[state->pc / 2];
+    if (inst->handler == NULL) {
+        chip8_decode(inst, get_opcode(state->memory, state->pc));
+    }
+    return inst;
+}
+
+int chip8_exec(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode) {
+    struct chip8_instruction inst;
+    chip8_decode(&inst, opcode);
+
+    return inst.handler(state, config, &inst);
+}
+
+// True when the instruction at pc waits in a loop that cannot end before the next timer tick or key event
+// Recognises a jump to itself, FX0A with no key held, and FX07 / 3XNN or 4XNN / jump back polling the delay timer
+bool chip8_is_idle(const struct chip8_state *state) {
+    if (state->pc >= sizeof(state->memory) - 1) {
+        return false;
+    }
+
+    // Wait loops the analysis did not see, e.g. in self-modified code, are only missed, never mistaken
+    if (state->analysis != NULL && !(state->analysis->flags[state->pc] & ANALYSIS_WAIT)) {
+        return false;
+    }
+
+    uint16_t opcode = get_opcode(state->memory, state->pc);
+
+    if (get_h(opcode) == 0xF && get_nn(opcode) == 0x0A) {
+        for (int i = 0; i < 16; i++) {
+            if (state->keys[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (get_h(opcode) != 0x1) {
+        return false;
+    }
+
+    uint16_t target = get_nnn(opcode);
+    if (target == state->pc) {
+        return true;
+    }
+    if (target + 4 != state->pc) {
+        return false;
+    }
+
+    uint16_t poll = get_opcode(state->memory, target);
+    uint16_t test = get_opcode(state->memory, target + 2);
+    uint8_t x = get_x(poll);
+
+    if (get_h(poll) != 0xF || get_nn(poll) != 0x07 || get_x(test) != x || state->registers[x] != state->delay_timer) {
+        return false;
+    }
+
+    switch (get_h(test)) {
+        case 0x3: return state->delay_timer != get_nn(test);
+        case 0x4: return state->delay_timer == get_nn(test);
+        default: return false;
+    }
+}
+
+#ifdef CHIP8_THREADED_DISPATCH
+
+// Labels-as-values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+#define label_entry(name) [CHIP8_OP_##name] = &&exec_##name,
+
+// Each handler jumps straight to the next one instead of returning through a switch
+#define dispatch() \
+    do { \
+        if (count-- == 0) { \
+            return (int64_t) total; \
+        } \
+        inst = chip8_fetch(state, &scratch); \
+        goto *labels[inst->op]; \
+    } while (0)
+
+#define label_body(name) \
+    exec_##name: \
+        if (chip8_op_may_idle(CHIP8_OP_##name) && chip8_is_idle(state)) { \
+            state->idle = true; \
+            return (int64_t) (total - count - 1); \
+        } \
+        if (chip8_op_uses_clock(CHIP8_OP_##name)) { \
+            state->batch_clock = total - count - 1; \
+        } \
+        if (chip8_exec_##name(state, config, inst) == -1) { \
+            return -1; \
+        } \
+        dispatch();
+
+// Execute count instructions, stopping early on error or once the program is idle
+// Returns how many instructions ran, or -1 on error
+int64_t chip8_exec_threaded(struct chip8_state *state, const struct chip8_config *config, uint64_t count) {
+    const uint64_t total = count;
+    static const void *const labels[] = {
+        [CHIP8_OP_UNKNOWN] = &&exec_unknown,
+        CHIP8_OPS(label_entry)
+    };
+
+    struct chip8_instruction scratch;
+    const struct chip8_instruction *inst;
+
+    dispatch();
+
+    exec_unknown:
+        return chip8_exec_unknown(state, config, inst);
+
+    CHIP8_OPS(label_body)
+}
+
+#pragma GCC diagnostic pop
+
+#endif // CHIP8_THREADED_DISPATCH
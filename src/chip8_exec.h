@@ -1,6 +1,8 @@
 #ifndef CHIP8_EXEC_H
 #define CHIP8_EXEC_H
 
+#include <stdbool.h>
+
 #include "chip8_config.h"
 #include "chip8_state.h"
 
@@ -13,6 +15,43 @@
 #define get_nn(opcode)  ((opcode) & 0x00FF)
 #define get_nnn(opcode) ((opcode) & 0x0FFF)
 
+#define get_opcode(memory, address) ((uint16_t) ((memory)[(address)] << 8 | (memory)[(address) + 1]))
+
+#define CHIP8_OPS(op) \
+    op(00BN) op(00CN) op(00DN) op(00E0) op(00EE) op(00FB) op(00FC) op(00FD) op(00FE) op(00FF) \
+    op(1NNN) op(2NNN) op(3XNN) op(4XNN) op(5XY0) op(6XNN) op(7XNN) \
+    op(8XY0) op(8XY1) op(8XY2) op(8XY3) op(8XY4) op(8XY5) op(8XY6) op(8XY7) op(8XYE) \
+    op(9XY0) op(ANNN) op(BXNN) op(CXNN) op(DXYN) op(EX9E) op(EXA1) \
+    op(FN01) op(F002) op(FX07) op(FX0A) op(FX15) op(FX18) op(FX1E) op(FX29) op(FX30) op(FX33) op(FX3A) op(FX55) op(FX65) op(FX75) op(FX85)
+
+#define chip8_op_entry(name) CHIP8_OP_##name,
+
+enum chip8_op {
+    CHIP8_OP_UNKNOWN,
+    CHIP8_OPS(chip8_op_entry)
+    CHIP8_OP_COUNT
+};
+
+// Every handler is exported so generated code can call it directly, e.g. chip8_exec_6XNN
+#define chip8_handler_decl(name) chip8_handler chip8_exec_##name;
+
+CHIP8_OPS(chip8_handler_decl)
+
+// Only these instructions can start a wait loop that chip8_is_idle recognises
+#define chip8_op_may_idle(op) ((op) == CHIP8_OP_1NNN || (op) == CHIP8_OP_FX0A)
+
+// Only these instructions read batch_clock, so the dispatch loops set it for nothing else
+#define chip8_op_uses_clock(op) ((op) == CHIP8_OP_FX18)
+
+void chip8_decode(struct chip8_instruction *inst, uint16_t opcode);
+const struct chip8_instruction *chip8_fetch(struct chip8_state *state, struct chip8_instruction *scratch);
+
 int chip8_exec(struct chip8_state *state, const struct chip8_config *config, uint16_t opcode);
 
+bool chip8_is_idle(const struct chip8_state *state);
+
+#ifdef CHIP8_THREADED_DISPATCH
+int64_t chip8_exec_threaded(struct chip8_state *state, const struct chip8_config *config, uint64_t count);
+#endif
+
 #endif // CHIP8_EXEC_H
@@ -0,0 +1,84 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8_frame.h"
+#include "chip8_state.h"
+
+#define FRAME_INDEX 0x3
+#define FRAME_FRESH 0x4
+
+// Copy the screen without touching its dirty rows, so every row counts as changed
+// Unused bytes are cleared, equal screens always give equal frames
+void chip8_snapshot_frame(struct chip8_frame *frame, const struct chip8_state *state, uint64_t number) {
+    frame->number = number;
+    frame->dirty_rows = UINT64_MAX;
+    frame->multi_plane = state->multi_plane;
+    frame->lores = state->lores_native && !state->multi_plane;
+
+    if (frame->lores) {
+        memset(frame->planes, 0, sizeof(frame->planes));
+        for (uint8_t y = 0; y < DISPLAY_HEIGHT / 2; y++) {
+            uint64_t row = state->lores_screen[y];
+            for (int i = DISPLAY_WIDTH / 16 - 1; i >= 0; i--) {
+                frame->planes[0][y * DISPLAY_WIDTH / 16 + i] = (uint8_t) row;
+                row >>= 8;
+            }
+        }
+        return;
+    }
+
+    chip8_pack_plane(state, 0, frame->planes[0]);
+    if (frame->multi_plane) {
+        chip8_pack_plane(state, 1, frame->planes[1]);
+    } else {
+        memset(frame->planes[1], 0, sizeof(frame->planes[1]));
+    }
+}
+
+// Snapshot the screen and take over its dirty rows
+void chip8_capture_frame(struct chip8_frame *frame, struct chip8_state *state, uint64_t number) {
+    chip8_snapshot_frame(frame, state, number);
+    frame->dirty_rows = state->dirty_rows;
+    state->dirty_rows = 0;
+}
+
+void chip8_init_frame_buffer(struct chip8_frame_buffer *buffer) {
+    memset(buffer->frames, 0, sizeof(buffer->frames));
+    atomic_init(&buffer->middle, 1);
+    buffer->back = 0;
+    buffer->front = 2;
+    buffer->unseen_dirty_rows = 0;
+}
+
+struct chip8_frame *chip8_back_frame(struct chip8_frame_buffer *buffer) {
+    return &buffer->frames[buffer->back];
+}
+
+void chip8_publish_frame(struct chip8_frame_buffer *buffer) {
+    struct chip8_frame *frame = &buffer->frames[buffer->back];
+
+    // A frame still in the middle may never be seen, so its rows have to be redrawn from this one
+    // If the consumer takes it between here and the exchange the extra rows are merely redrawn
+    if (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & FRAME_FRESH) {
+        buffer->unseen_dirty_rows |= frame->dirty_rows;
+    } else {
+        buffer->unseen_dirty_rows = frame->dirty_rows;
+    }
+    frame->dirty_rows = buffer->unseen_dirty_rows;
+
+    uint8_t old = atomic_exchange_explicit(&buffer->middle, buffer->back | FRAME_FRESH, memory_order_acq_rel);
+    buffer->back = old & FRAME_INDEX;
+}
+
+// Returns NULL when nothing was published since the last call
+const struct chip8_frame *chip8_take_frame(struct chip8_frame_buffer *buffer) {
+    if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) & FRAME_FRESH)) {
+        return NULL;
+    }
+
+    uint8_t old = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+    buffer->front = old & FRAME_INDEX;
+    return &buffer->frames[buffer->front];
+}
@@ -0,0 +1,49 @@
+#ifndef CHIP8_FRAME_H
+#define CHIP8_FRAME_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_state.h"
+
+// A finished screen, as handed from the emulator to whatever shows or records it
+struct chip8_frame {
+    uint64_t number;
+
+    // Rows changed since the last frame the consumer took
+    uint64_t dirty_rows;
+
+    // Set when planes[0] holds the 64x32 lores plane, 8 bytes per row, which is shown doubled
+    bool lores;
+    // Set when planes[1] is in use too, and pixels come from the palette
+    bool multi_plane;
+
+    uint8_t planes[SCREEN_PLANES][SCREEN_BYTES];
+};
+
+// Hands frames from one producer to one consumer without either ever waiting for the other
+// The producer fills back and publishes it, the consumer takes whichever frame was published last
+struct chip8_frame_buffer {
+    struct chip8_frame frames[3];
+
+    // Index of the frame in the middle, with FRAME_FRESH set until the consumer takes it
+    _Atomic uint8_t middle;
+
+    // Owned by the producer
+    uint8_t back;
+    uint64_t unseen_dirty_rows;
+
+    // Owned by the consumer
+    uint8_t front;
+};
+
+void chip8_snapshot_frame(struct chip8_frame *frame, const struct chip8_state *state, uint64_t number);
+void chip8_capture_frame(struct chip8_frame *frame, struct chip8_state *state, uint64_t number);
+
+void chip8_init_frame_buffer(struct chip8_frame_buffer *buffer);
+struct chip8_frame *chip8_back_frame(struct chip8_frame_buffer *buffer);
+void chip8_publish_frame(struct chip8_frame_buffer *buffer);
+const struct chip8_frame *chip8_take_frame(struct chip8_frame_buffer *buffer);
+
+#endif // CHIP8_FRAME_H
@@ -0,0 +1,301 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chip8_config.h"
+#include "chip8_exec.h"
+#include "chip8_jit.h"
+#include "chip8_state.h"
+
+#define JIT_CODE_SIZE (1 << 20)
+
+// Upper bound on the machine code emitted for one block
+#define JIT_MAX_BLOCK_SIZE (32 * JIT_MAX_BLOCK_LENGTH + 16)
+
+// x86-64 register numbers as used in the reg field of a ModRM byte
+#define AL 0
+#define CL 1
+
+// Generated code receives the state in rdi and addresses every CHIP-8 register as [rdi + disp32]
+#define V_OFFSET(x) ((uint32_t) (offsetof(struct chip8_state, registers) + (x)))
+#define I_OFFSET    ((uint32_t) offsetof(struct chip8_state, index_register))
+#define PC_OFFSET   ((uint32_t) offsetof(struct chip8_state, pc))
+
+#define emit(out, ...) emit_bytes((out), (const uint8_t []){__VA_ARGS__}, sizeof((const uint8_t []){__VA_ARGS__}))
+
+static void emit_bytes(uint8_t **out, const uint8_t *bytes, size_t length) {
+    memcpy(*out, bytes, length);
+    *out += length;
+}
+
+// Emit an instruction whose r/m operand is [rdi + disp]
+static void emit_rdi(uint8_t **out, uint8_t opcode, uint8_t reg, uint32_t disp) {
+    emit(out, opcode, 0x80 | (reg << 3) | 7, disp, disp >> 8, disp >> 16, disp >> 24);
+}
+
+// Store al to Vx and cl to VF, in that order so VF wins when x is F
+static void emit_store_flag(uint8_t **out, uint8_t x) {
+    emit_rdi(out, 0x88, AL, V_OFFSET(x));
+    emit_rdi(out, 0x88, CL, V_OFFSET(0xF));
+}
+
+// Emit native code for inst, or return false if it must be interpreted
+static bool chip8_emit_instruction(uint8_t **out, const struct chip8_instruction *inst) {
+    switch (inst->op) {
+        // mov byte [Vx], NN
+        case CHIP8_OP_6XNN:
+            emit_rdi(out, 0xC6, 0, V_OFFSET(inst->x));
+            emit(out, inst->nn);
+            return true;
+
+        // add byte [Vx], NN
+        case CHIP8_OP_7XNN:
+            emit_rdi(out, 0x80, 0, V_OFFSET(inst->x));
+            emit(out, inst->nn);
+            return true;
+
+        // mov al, [Vy]; mov [Vx], al
+        case CHIP8_OP_8XY0:
+            emit_rdi(out, 0x8A, AL, V_OFFSET(inst->y));
+            emit_rdi(out, 0x88, AL, V_OFFSET(inst->x));
+            return true;
+
+        // mov al, [Vy]; or/and/xor [Vx], al
+        case CHIP8_OP_8XY1:
+        case CHIP8_OP_8XY2:
+        case CHIP8_OP_8XY3:
+            emit_rdi(out, 0x8A, AL, V_OFFSET(inst->y));
+            emit_rdi(out, inst->op == CHIP8_OP_8XY1 ? 0x08 : inst->op == CHIP8_OP_8XY2 ? 0x20 : 0x30, AL, V_OFFSET(inst->x));
+            return true;
+
+        // mov al, [Vx]; add al, [Vy]; setc cl
+        case CHIP8_OP_8XY4:
+            emit_rdi(out, 0x8A, AL, V_OFFSET(inst->x));
+            emit_rdi(out, 0x02, AL, V_OFFSET(inst->y));
+            emit(out, 0x0F, 0x92, 0xC1);
+            emit_store_flag(out, inst->x);
+            return true;
+
+        // mov al, [Vx]; sub al, [Vy]; setae cl
+        case CHIP8_OP_8XY5:
+            emit_rdi(out, 0x8A, AL, V_OFFSET(inst->x));
+            emit_rdi(out, 0x2A, AL, V_OFFSET(inst->y));
+            emit(out, 0x0F, 0x93, 0xC1);
+            emit_store_flag(out, inst->x);
+            return true;
+
+        // mov al, [Vx]; mov cl, al; and cl, 1; shr al, 1
+        case CHIP8_OP_8XY6:
+            emit_rdi(out, 0x8A, AL, V_OFFSET(inst->x));
+            emit(out, 0x88, 0xC1, 0x80, 0xE1, 0x01, 0xD0, 0xE8);
+            emit_store_flag(out, inst->x);
+            return true;
+
+        // mov al, [Vy]; sub al, [Vx]; setae cl
+        case CHIP8_OP_8XY7:
+            emit_rdi(out, 0x8A, AL, V_OFFSET(inst->y));
+            emit_rdi(out, 0x2A, AL, V_OFFSET(inst->x));
+            emit(out, 0x0F, 0x93, 0xC1);
+            emit_store_flag(out, inst->x);
+            return true;
+
+        // mov al, [Vx]; mov cl, al; shr cl, 7; shl al, 1
+        case CHIP8_OP_8XYE:
+            emit_rdi(out, 0x8A, AL, V_OFFSET(inst->x));
+            emit(out, 0x88, 0xC1, 0xC0, 0xE9, 0x07, 0xD0, 0xE0);
+            emit_store_flag(out, inst->x);
+            return true;
+
+        // mov word [I], NNN
+        case CHIP8_OP_ANNN:
+            emit(out, 0x66);
+            emit_rdi(out, 0xC7, 0, I_OFFSET);
+            emit(out, inst->nnn, inst->nnn >> 8);
+            return true;
+
+        // movzx eax, byte [Vx]; add ax, [I]; and ax, 0xFFF; mov [I], ax
+        case CHIP8_OP_FX1E:
+            emit(out, 0x0F);
+            emit_rdi(out, 0xB6, AL, V_OFFSET(inst->x));
+            emit(out, 0x66);
+            emit_rdi(out, 0x03, AL, I_OFFSET);
+            emit(out, 0x66, 0x25, 0xFF, 0x0F, 0x66);
+            emit_rdi(out, 0x89, AL, I_OFFSET);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static int chip8_protect_jit(struct chip8_jit *jit, int prot) {
+    if (mprotect(jit->code, jit->code_size, prot) == -1) {
+        fprintf(stderr, "%s: mprotect: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Compile the block starting at the even address start
+// Blocks end after 1NNN or before the first instruction that has to be interpreted
+static int chip8_compile_block(struct chip8_jit *jit, const struct chip8_state *state, uint16_t start) {
+    if (jit->code_size - jit->code_used < JIT_MAX_BLOCK_SIZE) {
+        chip8_flush_jit(jit);
+    }
+
+    struct chip8_jit_block *block = &jit->blocks[start / 2];
+    block->compiled = true;
+    block->length = 0;
+    block->code = NULL;
+
+    if (chip8_protect_jit(jit, PROT_READ | PROT_WRITE) == -1) {
+        return -1;
+    }
+
+    uint8_t *begin = &jit->code[jit->code_used];
+    uint8_t *out = begin;
+    uint16_t pc = start;
+
+    while (block->length < JIT_MAX_BLOCK_LENGTH && pc < sizeof(state->memory) - 1) {
+        struct chip8_instruction inst;
+        chip8_decode(&inst, get_opcode(state->memory, pc));
+
+        if (inst.op == CHIP8_OP_1NNN) {
+            block->length++;
+            pc = inst.nnn;
+            break;
+        }
+
+        if (!chip8_emit_instruction(&out, &inst)) {
+            break;
+        }
+        block->length++;
+        pc += 2;
+    }
+
+    uint16_t end = start + 2 * (block->length > 0 ? block->length : 1);
+    for (uint16_t page = start / JIT_PAGE_SIZE; page <= (end - 1) / JIT_PAGE_SIZE; page++) {
+        jit->page_has_code[page] = true;
+    }
+
+    if (block->length > 0) {
+        // mov word [pc], pc; ret
+        emit(&out, 0x66);
+        emit_rdi(&out, 0xC7, 0, PC_OFFSET);
+        emit(&out, pc, pc >> 8, 0xC3);
+
+        // ISO C has no conversion from object to function pointers
+        memcpy(&block->code, &begin, sizeof(block->code));
+        jit->code_used += out - begin;
+    }
+
+    return chip8_protect_jit(jit, PROT_READ | PROT_EXEC);
+}
+
+int chip8_init_jit(struct chip8_jit *jit, const struct chip8_config *config) {
+    (void) config;
+
+    memset(jit, 0, sizeof(*jit));
+
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap: %s\n", __func__, strerror(errno));
+        jit->code = NULL;
+        return -1;
+    }
+    jit->code_size = JIT_CODE_SIZE;
+
+    return 0;
+}
+
+int chip8_close_jit(struct chip8_jit *jit, const struct chip8_config *config) {
+    (void) config;
+
+    if (jit->code != NULL) {
+        munmap(jit->code, jit->code_size);
+    }
+    memset(jit, 0, sizeof(*jit));
+
+    return 0;
+}
+
+// Drop every compiled block and reuse the code buffer from the start
+void chip8_flush_jit(struct chip8_jit *jit) {
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->page_has_code, 0, sizeof(jit->page_has_code));
+    jit->code_used = 0;
+}
+
+// Drop the blocks covering any byte from first to last inclusive
+static void chip8_invalidate_range(struct chip8_jit *jit, uint16_t first, uint16_t last) {
+    bool has_code = false;
+    for (uint16_t page = first / JIT_PAGE_SIZE; page <= last / JIT_PAGE_SIZE; page++) {
+        has_code |= jit->page_has_code[page];
+    }
+    if (!has_code) {
+        return;
+    }
+
+    uint16_t start = (first > 2 * JIT_MAX_BLOCK_LENGTH) ? (first - 2 * JIT_MAX_BLOCK_LENGTH) & ~1 : 0;
+    for (; start <= last; start += 2) {
+        struct chip8_jit_block *block = &jit->blocks[start / 2];
+        if (block->compiled && start + 2 * (block->length > 0 ? block->length : 1) > first) {
+            block->compiled = false;
+        }
+    }
+}
+
+// Must be called whenever memory is written so blocks compiled from the old code are dropped
+void chip8_invalidate_jit(struct chip8_jit *jit, uint16_t address, uint16_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    address &= 0xFFF;
+    if (address + length > 0x1000) {
+        chip8_invalidate_range(jit, address, 0xFFF);
+        chip8_invalidate_range(jit, 0, address + length - 0x1001);
+    } else {
+        chip8_invalidate_range(jit, address, address + length - 1);
+    }
+}
+
+// Execute count instructions, running compiled blocks where possible and stopping early once idle
+// Returns how many instructions ran, or -1 on error
+int64_t chip8_run_jit(struct chip8_state *state, const struct chip8_config *config, uint64_t count) {
+    const uint64_t total = count;
+    struct chip8_jit *jit = state->jit;
+
+    while (count > 0) {
+        if (chip8_is_idle(state)) {
+            state->idle = true;
+            return (int64_t) (total - count);
+        }
+
+        if (state->pc % 2 == 0 && state->pc < sizeof(state->memory) - 1) {
+            struct chip8_jit_block *block = &jit->blocks[state->pc / 2];
+            if (!block->compiled && chip8_compile_block(jit, state, state->pc) == -1) {
+                return -1;
+            }
+
+            if (block->length > 0 && block->length <= count) {
+                block->code(state);
+                count -= block->length;
+                continue;
+            }
+        }
+
+        // Compiled blocks never contain an instruction that reads the clock
+        state->batch_clock = total - count;
+        if (chip8_advance_state(state, config) == -1) {
+            return -1;
+        }
+        count--;
+    }
+
+    return (int64_t) total;
+}
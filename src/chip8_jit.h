@@ -0,0 +1,46 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_config.h"
+#include "chip8_state.h"
+
+#if defined(CHIP8_JIT) && !defined(__x86_64__)
+#error "the JIT backend emits x86-64 code and can only be built for x86-64 hosts"
+#endif
+
+// Longest run of instructions compiled into a single block
+#define JIT_MAX_BLOCK_LENGTH 64
+
+// Granularity at which memory writes are checked against compiled code
+#define JIT_PAGE_SIZE 256
+
+// A straight-line run of instructions starting at an even address
+// A compiled block with length 0 starts with an instruction that is always interpreted
+struct chip8_jit_block {
+    void (*code)(struct chip8_state *state);
+    uint16_t length;
+    bool compiled;
+};
+
+struct chip8_jit {
+    uint8_t *code;
+    size_t code_size;
+    size_t code_used;
+
+    struct chip8_jit_block blocks[4096 / 2];
+    bool page_has_code[4096 / JIT_PAGE_SIZE];
+};
+
+int chip8_init_jit(struct chip8_jit *jit, const struct chip8_config *config);
+int chip8_close_jit(struct chip8_jit *jit, const struct chip8_config *config);
+
+void chip8_flush_jit(struct chip8_jit *jit);
+void chip8_invalidate_jit(struct chip8_jit *jit, uint16_t address, uint16_t length);
+
+int64_t chip8_run_jit(struct chip8_state *state, const struct chip8_config *config, uint64_t count);
+
+#endif // CHIP8_JIT_H
@@ -0,0 +1,470 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "chip8_config.h"
+#include "chip8_exec.h"
+#include "chip8_multi.h"
+#include "chip8_state.h"
+#include "helper.h"
+
+#define MAX_PROGRAM_LENGTH (sizeof(((struct chip8_state *) NULL)->memory) - PROGRAM_MEMORY_OFFSET)
+
+int chip8_init_multi(struct chip8_multi *multi, const struct chip8_config *config, size_t num_lanes) {
+    memset(multi, 0, sizeof(*multi));
+
+    multi->num_lanes = num_lanes;
+    multi->padded_lanes = (num_lanes + MULTI_LANE_ALIGN - 1) / MULTI_LANE_ALIGN * MULTI_LANE_ALIGN;
+
+    size_t n = multi->padded_lanes;
+    multi->registers[0] = calloc(16 * n, sizeof(uint8_t));
+    multi->index_register = calloc(n, sizeof(uint16_t));
+    multi->pc = calloc(n, sizeof(uint16_t));
+    multi->delay_timer = calloc(n, sizeof(uint8_t));
+    multi->sound_timer = calloc(n, sizeof(uint8_t));
+    multi->own_code = calloc(n, sizeof(bool));
+    multi->pending = calloc(n, sizeof(uint8_t));
+    multi->mask = calloc(n, sizeof(uint8_t));
+    multi->step = calloc(n, sizeof(uint8_t));
+    multi->states = calloc(num_lanes, sizeof(struct chip8_state));
+
+    if (multi->registers[0] == NULL || multi->index_register == NULL || multi->pc == NULL || multi->delay_timer == NULL ||
+        multi->sound_timer == NULL || multi->own_code == NULL || multi->pending == NULL || multi->mask == NULL ||
+        multi->step == NULL || multi->states == NULL) {
+        multi->num_lanes = 0;
+        chip8_close_multi(multi, config);
+        return -1;
+    }
+
+    for (uint8_t x = 1; x < 16; x++) {
+        multi->registers[x] = multi->registers[0] + x * n;
+    }
+
+    for (size_t i = 0; i < num_lanes; i++) {
+        if (chip8_init_state(&multi->states[i], config) == -1) {
+            multi->num_lanes = i;
+            chip8_close_multi(multi, config);
+            return -1;
+        }
+    }
+
+#ifdef __x86_64__
+    multi->use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    return chip8_load_multi_memory(multi, config, NULL, 0);
+}
+
+int chip8_close_multi(struct chip8_multi *multi, const struct chip8_config *config) {
+    for (size_t i = 0; i < multi->num_lanes; i++) {
+        chip8_close_state(&multi->states[i], config);
+    }
+
+    free(multi->registers[0]);
+    free(multi->index_register);
+    free(multi->pc);
+    free(multi->delay_timer);
+    free(multi->sound_timer);
+    free(multi->own_code);
+    free(multi->pending);
+    free(multi->mask);
+    free(multi->step);
+    free(multi->states);
+
+    memset(multi, 0, sizeof(*multi));
+    return 0;
+}
+
+// Copy the lane's fields out of the arrays and into its state
+static void chip8_multi_store_lane(struct chip8_multi *multi, size_t lane) {
+    struct chip8_state *state = &multi->states[lane];
+
+    for (uint8_t x = 0; x < 16; x++) {
+        state->registers[x] = multi->registers[x][lane];
+    }
+    state->index_register = multi->index_register[lane];
+    state->pc = multi->pc[lane];
+    state->delay_timer = multi->delay_timer[lane];
+    state->sound_timer = multi->sound_timer[lane];
+}
+
+// Copy the lane's fields from its state back into the arrays
+static void chip8_multi_load_lane(struct chip8_multi *multi, size_t lane) {
+    const struct chip8_state *state = &multi->states[lane];
+
+    for (uint8_t x = 0; x < 16; x++) {
+        multi->registers[x][lane] = state->registers[x];
+    }
+    multi->index_register[lane] = state->index_register;
+    multi->pc[lane] = state->pc;
+    multi->delay_timer[lane] = state->delay_timer;
+    multi->sound_timer[lane] = state->sound_timer;
+}
+
+void chip8_sync_multi(struct chip8_multi *multi) {
+    for (size_t i = 0; i < multi->num_lanes; i++) {
+        chip8_multi_store_lane(multi, i);
+    }
+}
+
+// Copy the memory of lane 0 into the shared image and every other lane, then reset them all
+static void chip8_multi_start(struct chip8_multi *multi, const struct chip8_config *config) {
+    memcpy(multi->memory, multi->states[0].memory, sizeof(multi->memory));
+
+    for (size_t i = 0; i < multi->num_lanes; i++) {
+        if (i > 0) {
+            chip8_reset_state(&multi->states[i], config);
+            memcpy(multi->states[i].memory, multi->memory, sizeof(multi->memory));
+        }
+        chip8_multi_load_lane(multi, i);
+        multi->own_code[i] = false;
+    }
+}
+
+int chip8_load_multi_program(struct chip8_multi *multi, const struct chip8_config *config, const char *file) {
+    if (multi->num_lanes == 0) {
+        return 0;
+    }
+
+    chip8_reset_state(&multi->states[0], config);
+    if (chip8_load_program(&multi->states[0], config, file) == -1) {
+        return -1;
+    }
+
+    chip8_multi_start(multi, config);
+    return 0;
+}
+
+int chip8_load_multi_memory(struct chip8_multi *multi, const struct chip8_config *config, const uint8_t *program, size_t length) {
+    if (length > MAX_PROGRAM_LENGTH) {
+        fprintf(stderr, "%s: program must not exceed %zu bytes\n", __func__, (size_t) MAX_PROGRAM_LENGTH);
+        return -1;
+    }
+    if (multi->num_lanes == 0) {
+        return 0;
+    }
+
+    chip8_reset_state(&multi->states[0], config);
+    if (length > 0) {
+        memcpy(&multi->states[0].memory[PROGRAM_MEMORY_OFFSET], program, length);
+    }
+
+    chip8_multi_start(multi, config);
+    return 0;
+}
+
+static uint16_t chip8_multi_opcode(const struct chip8_multi *multi, size_t lane, uint16_t pc) {
+    const uint8_t *memory = multi->own_code[lane] ? multi->states[lane].memory : multi->memory;
+    return get_opcode(memory, pc);
+}
+
+// Run one instruction on a single lane through the interpreter
+static int chip8_multi_exec_lane(struct chip8_multi *multi, const struct chip8_config *config, size_t lane) {
+    struct chip8_state *state = &multi->states[lane];
+
+    chip8_multi_store_lane(multi, lane);
+    uint32_t memory_writes = state->memory_writes;
+
+    int result = chip8_advance_state(state, config);
+
+    chip8_multi_load_lane(multi, lane);
+    if (state->memory_writes != memory_writes) {
+        multi->own_code[lane] = true;
+    }
+
+    return result;
+}
+
+static bool chip8_multi_is_alu(uint8_t op) {
+    switch (op) {
+        case CHIP8_OP_3XNN: case CHIP8_OP_4XNN: case CHIP8_OP_5XY0: case CHIP8_OP_9XY0:
+        case CHIP8_OP_6XNN: case CHIP8_OP_7XNN:
+        case CHIP8_OP_8XY0: case CHIP8_OP_8XY1: case CHIP8_OP_8XY2: case CHIP8_OP_8XY3:
+        case CHIP8_OP_8XY4: case CHIP8_OP_8XY5: case CHIP8_OP_8XY6: case CHIP8_OP_8XY7: case CHIP8_OP_8XYE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Apply an ALU or skip instruction to every masked lane and set step to how far each lane's pc moves
+// Matches the semantics of the handlers in chip8_exec.c
+static void chip8_multi_alu_scalar(struct chip8_multi *multi, const struct chip8_instruction *inst) {
+    uint8_t *vx = multi->registers[inst->x];
+    uint8_t *vy = multi->registers[inst->y];
+    uint8_t *vf = multi->registers[0xF];
+
+    for (size_t i = 0; i < multi->padded_lanes; i++) {
+        multi->step[i] = 0;
+        if (!multi->mask[i]) {
+            continue;
+        }
+
+        uint8_t x = vx[i];
+        uint8_t y = vy[i];
+        uint8_t result = x;
+        uint8_t flag = 0;
+        bool skip = false;
+        bool writes_flag = false;
+
+        switch (inst->op) {
+            case CHIP8_OP_3XNN: skip = (x == inst->nn); break;
+            case CHIP8_OP_4XNN: skip = (x != inst->nn); break;
+            case CHIP8_OP_5XY0: skip = (x == y); break;
+            case CHIP8_OP_9XY0: skip = (x != y); break;
+            case CHIP8_OP_6XNN: result = inst->nn; break;
+            case CHIP8_OP_7XNN: result = x + inst->nn; break;
+            case CHIP8_OP_8XY0: result = y; break;
+            case CHIP8_OP_8XY1: result = x | y; break;
+            case CHIP8_OP_8XY2: result = x & y; break;
+            case CHIP8_OP_8XY3: result = x ^ y; break;
+            case CHIP8_OP_8XY4: result = x + y; flag = (x > UINT8_MAX - y); writes_flag = true; break;
+            case CHIP8_OP_8XY5: result = x - y; flag = (x >= y); writes_flag = true; break;
+            case CHIP8_OP_8XY6: result = x >> 1; flag = x & 1; writes_flag = true; break;
+            case CHIP8_OP_8XY7: result = y - x; flag = (y >= x); writes_flag = true; break;
+            case CHIP8_OP_8XYE: result = x << 1; flag = x >> 7; writes_flag = true; break;
+        }
+
+        vx[i] = result;
+        if (writes_flag) {
+            vf[i] = flag;
+        }
+        multi->step[i] = skip ? 4 : 2;
+    }
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static void chip8_multi_alu_avx2(struct chip8_multi *multi, const struct chip8_instruction *inst) {
+    uint8_t *vx = multi->registers[inst->x];
+    uint8_t *vy = multi->registers[inst->y];
+    uint8_t *vf = multi->registers[0xF];
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi8(-1);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    const __m256i nn = _mm256_set1_epi8((char) inst->nn);
+
+    for (size_t i = 0; i < multi->padded_lanes; i += 32) {
+        __m256i mask = _mm256_loadu_si256((const __m256i *) &multi->mask[i]);
+        if (_mm256_testz_si256(mask, mask)) {
+            _mm256_storeu_si256((__m256i *) &multi->step[i], zero);
+            continue;
+        }
+
+        __m256i x = _mm256_loadu_si256((const __m256i *) &vx[i]);
+        __m256i y = _mm256_loadu_si256((const __m256i *) &vy[i]);
+        __m256i result = x;
+        __m256i flag = zero;
+        __m256i skip = zero;
+        bool writes_flag = false;
+
+        switch (inst->op) {
+            case CHIP8_OP_3XNN: skip = _mm256_cmpeq_epi8(x, nn); break;
+            case CHIP8_OP_4XNN: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(x, nn), ones); break;
+            case CHIP8_OP_5XY0: skip = _mm256_cmpeq_epi8(x, y); break;
+            case CHIP8_OP_9XY0: skip = _mm256_xor_si256(_mm256_cmpeq_epi8(x, y), ones); break;
+            case CHIP8_OP_6XNN: result = nn; break;
+            case CHIP8_OP_7XNN: result = _mm256_add_epi8(x, nn); break;
+            case CHIP8_OP_8XY0: result = y; break;
+            case CHIP8_OP_8XY1: result = _mm256_or_si256(x, y); break;
+            case CHIP8_OP_8XY2: result = _mm256_and_si256(x, y); break;
+            case CHIP8_OP_8XY3: result = _mm256_xor_si256(x, y); break;
+
+            // Carry out when the sum wraps below x
+            case CHIP8_OP_8XY4:
+                result = _mm256_add_epi8(x, y);
+                flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(result, x), result), one);
+                writes_flag = true;
+                break;
+
+            // No borrow when x >= y, i.e. max(x, y) == x
+            case CHIP8_OP_8XY5:
+                result = _mm256_sub_epi8(x, y);
+                flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, y), x), one);
+                writes_flag = true;
+                break;
+
+            // There is no 8-bit shift, so shift 16-bit words and clear the bit shifted in from the neighbour
+            case CHIP8_OP_8XY6:
+                result = _mm256_and_si256(_mm256_srli_epi16(x, 1), _mm256_set1_epi8(0x7F));
+                flag = _mm256_and_si256(x, one);
+                writes_flag = true;
+                break;
+
+            case CHIP8_OP_8XY7:
+                result = _mm256_sub_epi8(y, x);
+                flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, y), y), one);
+                writes_flag = true;
+                break;
+
+            case CHIP8_OP_8XYE:
+                result = _mm256_add_epi8(x, x);
+                flag = _mm256_and_si256(_mm256_srli_epi16(x, 7), one);
+                writes_flag = true;
+                break;
+        }
+
+        // Vx is stored before VF is loaded so VF wins when x is F
+        _mm256_storeu_si256((__m256i *) &vx[i], _mm256_blendv_epi8(x, result, mask));
+        if (writes_flag) {
+            __m256i f = _mm256_loadu_si256((const __m256i *) &vf[i]);
+            _mm256_storeu_si256((__m256i *) &vf[i], _mm256_blendv_epi8(f, flag, mask));
+        }
+
+        __m256i step = _mm256_add_epi8(two, _mm256_and_si256(skip, two));
+        _mm256_storeu_si256((__m256i *) &multi->step[i], _mm256_and_si256(step, mask));
+    }
+}
+
+__attribute__((target("avx2")))
+static void chip8_multi_step_pc_avx2(struct chip8_multi *multi) {
+    for (size_t i = 0; i < multi->padded_lanes; i += 16) {
+        __m256i step = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &multi->step[i]));
+        __m256i pc = _mm256_loadu_si256((const __m256i *) &multi->pc[i]);
+        _mm256_storeu_si256((__m256i *) &multi->pc[i], _mm256_add_epi16(pc, step));
+    }
+}
+
+__attribute__((target("avx2")))
+static void chip8_multi_tick_avx2(struct chip8_multi *multi) {
+    const __m256i one = _mm256_set1_epi8(1);
+
+    for (size_t i = 0; i < multi->padded_lanes; i += 32) {
+        __m256i delay = _mm256_loadu_si256((const __m256i *) &multi->delay_timer[i]);
+        __m256i sound = _mm256_loadu_si256((const __m256i *) &multi->sound_timer[i]);
+        _mm256_storeu_si256((__m256i *) &multi->delay_timer[i], _mm256_subs_epu8(delay, one));
+        _mm256_storeu_si256((__m256i *) &multi->sound_timer[i], _mm256_subs_epu8(sound, one));
+    }
+}
+#endif
+
+static void chip8_multi_alu(struct chip8_multi *multi, const struct chip8_instruction *inst) {
+#ifdef __x86_64__
+    if (multi->use_avx2) {
+        chip8_multi_alu_avx2(multi, inst);
+        chip8_multi_step_pc_avx2(multi);
+        return;
+    }
+#endif
+
+    chip8_multi_alu_scalar(multi, inst);
+    for (size_t i = 0; i < multi->padded_lanes; i++) {
+        multi->pc[i] += multi->step[i];
+    }
+}
+
+static void chip8_multi_tick(struct chip8_multi *multi) {
+#ifdef __x86_64__
+    if (multi->use_avx2) {
+        chip8_multi_tick_avx2(multi);
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < multi->padded_lanes; i++) {
+        multi->delay_timer[i] -= (multi->delay_timer[i] > 0);
+        multi->sound_timer[i] -= (multi->sound_timer[i] > 0);
+    }
+}
+
+// Execute one instruction on every running lane
+// Lanes are grouped by pc and opcode, the first pending lane picks the group each time round
+static int chip8_multi_step(struct chip8_multi *multi, const struct chip8_config *config) {
+    size_t num_pending = 0;
+    for (size_t i = 0; i < multi->num_lanes; i++) {
+        multi->pending[i] = multi->states[i].stopped ? 0 : 0xFF;
+        num_pending += !multi->states[i].stopped;
+    }
+
+    size_t first = 0;
+    while (num_pending > 0) {
+        while (!multi->pending[first]) {
+            first++;
+        }
+
+        uint16_t pc = multi->pc[first];
+        if (pc >= sizeof(multi->memory) - 1) {
+            multi->pending[first] = 0;
+            num_pending--;
+            if (chip8_multi_exec_lane(multi, config, first) == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        uint16_t opcode = chip8_multi_opcode(multi, first, pc);
+        bool shared_matches = (get_opcode(multi->memory, pc) == opcode);
+
+        for (size_t i = first; i < multi->num_lanes; i++) {
+            bool same = multi->pending[i] && multi->pc[i] == pc &&
+                        (multi->own_code[i] ? chip8_multi_opcode(multi, i, pc) == opcode : shared_matches);
+            multi->mask[i] = same ? 0xFF : 0;
+            multi->pending[i] &= ~multi->mask[i];
+            num_pending -= same;
+        }
+
+        struct chip8_instruction inst;
+        chip8_decode(&inst, opcode);
+
+        if (chip8_multi_is_alu(inst.op)) {
+            memset(multi->mask, 0, first);
+            chip8_multi_alu(multi, &inst);
+            continue;
+        }
+
+        for (size_t i = first; i < multi->num_lanes; i++) {
+            if (!multi->mask[i]) {
+                continue;
+            }
+
+            switch (inst.op) {
+                case CHIP8_OP_1NNN:
+                    multi->pc[i] = inst.nnn;
+                    break;
+
+                case CHIP8_OP_ANNN:
+                    multi->index_register[i] = inst.nnn;
+                    multi->pc[i] += 2;
+                    break;
+
+                default:
+                    if (chip8_multi_exec_lane(multi, config, i) == -1) {
+                        return -1;
+                    }
+                    break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Execute count instructions on every lane that has not stopped
+int chip8_advance_multi(struct chip8_multi *multi, const struct chip8_config *config, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (chip8_multi_step(multi, config) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Run one frame worth of instructions on every lane, then tick the timers
+int chip8_advance_multi_frame(struct chip8_multi *multi, const struct chip8_config *config, uint64_t frame_number) {
+    if (chip8_advance_multi(multi, config, chip8_frame_instructions(config, frame_number)) == -1) {
+        return -1;
+    }
+
+    chip8_multi_tick(multi);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef CHIP8_MULTI_H
+#define CHIP8_MULTI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_config.h"
+#include "chip8_state.h"
+
+// Lane counts are padded to a whole number of 256-bit vectors
+#define MULTI_LANE_ALIGN 32
+
+// Many instances of the same program stepped in lockstep
+// Registers, I, pc and timers are stored as one array per field, indexed by lane
+struct chip8_multi {
+    size_t num_lanes;
+    size_t padded_lanes;
+
+    uint8_t *registers[16];
+    uint16_t *index_register;
+    uint16_t *pc;
+    uint8_t *delay_timer;
+    uint8_t *sound_timer;
+
+    // Memory, screen, stack and keys of each lane
+    // Their registers, I, pc and timers are only up to date after chip8_sync_multi
+    struct chip8_state *states;
+
+    // Code image shared by every lane whose memory has not been written since loading
+    uint8_t memory[4096];
+    bool *own_code;
+
+    // Per-lane scratch bytes used while stepping
+    uint8_t *pending;
+    uint8_t *mask;
+    uint8_t *step;
+
+    bool use_avx2;
+};
+
+int chip8_init_multi(struct chip8_multi *multi, const struct chip8_config *config, size_t num_lanes);
+int chip8_close_multi(struct chip8_multi *multi, const struct chip8_config *config);
+
+int chip8_load_multi_program(struct chip8_multi *multi, const struct chip8_config *config, const char *file);
+int chip8_load_multi_memory(struct chip8_multi *multi, const struct chip8_config *config, const uint8_t *program, size_t length);
+
+void chip8_sync_multi(struct chip8_multi *multi);
+
+int chip8_advance_multi(struct chip8_multi *multi, const struct chip8_config *config, uint64_t count);
+int chip8_advance_multi_frame(struct chip8_multi *multi, const struct chip8_config *config, uint64_t frame_number);
+
+#endif // CHIP8_MULTI_H
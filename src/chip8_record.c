@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8_config.h"
+#include "chip8_frame.h"
+#include "chip8_record.h"
+#include "chip8_render.h"
+#include "chip8_state.h"
+
+// BT.601 studio range, which is what encoders assume for Y4M without a colour range tag
+static void chip8_rgb_to_yuv(uint32_t argb, uint8_t *yuv) {
+    int r = (argb >> 16) & 0xFF;
+    int g = (argb >> 8) & 0xFF;
+    int b = argb & 0xFF;
+    yuv[0] = (uint8_t) (16 + (66 * r + 129 * g + 25 * b + 128) / 256);
+    yuv[1] = (uint8_t) (128 + (-38 * r - 74 * g + 112 * b + 128) / 256);
+    yuv[2] = (uint8_t) (128 + (112 * r - 94 * g - 18 * b + 128) / 256);
+}
+
+static void chip8_encode_frame(struct chip8_recorder *recorder, const struct chip8_frame *frame) {
+    chip8_render_rows(frame, &recorder->pixels[0][0], sizeof(recorder->pixels[0]), 0, DISPLAY_HEIGHT - 1, recorder->use_avx2);
+
+    const uint32_t *pixels = &recorder->pixels[0][0];
+    uint8_t *out = recorder->encoded;
+    size_t count = DISPLAY_WIDTH * DISPLAY_HEIGHT;
+
+    if (recorder->format == VIDEO_PPM) {
+        for (size_t i = 0; i < count; i++) {
+            out[3 * i + 0] = (uint8_t) (pixels[i] >> 16);
+            out[3 * i + 1] = (uint8_t) (pixels[i] >> 8);
+            out[3 * i + 2] = (uint8_t) pixels[i];
+        }
+        return;
+    }
+
+    // Planar Y, then Cb, then Cr, every pixel is one of the palette colours
+    for (size_t i = 0; i < count; i++) {
+        uint8_t index = 0;
+        while (index < (1 << SCREEN_PLANES) - 1 && chip8_palette[index] != pixels[i]) {
+            index++;
+        }
+        out[i] = recorder->yuv[index][0];
+        out[count + i] = recorder->yuv[index][1];
+        out[2 * count + i] = recorder->yuv[index][2];
+    }
+}
+
+static bool chip8_same_screen(const struct chip8_frame *a, const struct chip8_frame *b) {
+    return a->lores == b->lores && a->multi_plane == b->multi_plane && memcmp(a->planes, b->planes, sizeof(a->planes)) == 0;
+}
+
+static int chip8_write_frame(struct chip8_recorder *recorder, const struct chip8_frame *frame) {
+    if (recorder->has_previous && chip8_same_screen(frame, &recorder->previous)) {
+        recorder->frames_repeated++;
+    } else {
+        chip8_encode_frame(recorder, frame);
+        recorder->previous = *frame;
+        recorder->has_previous = true;
+    }
+
+    if (recorder->format == VIDEO_PPM) {
+        fprintf(recorder->out, "P6\n%d %d\n255\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    } else {
+        fputs("FRAME\n", recorder->out);
+    }
+    if (fwrite(recorder->encoded, sizeof(recorder->encoded), 1, recorder->out) != 1) {
+        fprintf(stderr, "%s: fwrite: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    recorder->frames_written++;
+    return 0;
+}
+
+// One wakeup per queued frame, and a last one from chip8_close_recorder once nothing else will be queued
+static void *chip8_recorder_main(void *arg) {
+    struct chip8_recorder *recorder = arg;
+
+    for (;;) {
+        while (sem_wait(&recorder->pending) == -1 && errno == EINTR);
+
+        uint32_t tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&recorder->head, memory_order_acquire)) {
+            if (atomic_load(&recorder->closing)) {
+                return NULL;
+            }
+            continue;
+        }
+
+        // After a write error frames are still drained so the emulator keeps going
+        const struct chip8_frame *frame = &recorder->queue[tail % RECORD_QUEUE_LENGTH];
+        if (!recorder->failed && chip8_write_frame(recorder, frame) == -1) {
+            recorder->failed = true;
+        }
+        atomic_store_explicit(&recorder->tail, tail + 1, memory_order_release);
+        sem_post(&recorder->space);
+    }
+}
+
+// path is a file name or - for standard output, a name ending in .ppm picks PPM and anything else Y4M
+int chip8_open_recorder(struct chip8_recorder *recorder, const char *path, const struct chip8_config *config) {
+    (void) config;
+
+    memset(recorder, 0, sizeof(*recorder));
+
+    size_t length = strlen(path);
+    recorder->format = (length >= 4 && strcmp(path + length - 4, ".ppm") == 0) ? VIDEO_PPM : VIDEO_Y4M;
+#ifdef __x86_64__
+    recorder->use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    for (uint8_t i = 0; i < 1 << SCREEN_PLANES; i++) {
+        chip8_rgb_to_yuv(chip8_palette[i], recorder->yuv[i]);
+    }
+
+    recorder->out = (strcmp(path, "-") == 0) ? stdout : fopen(path, "wb");
+    if (recorder->out == NULL) {
+        fprintf(stderr, "%s: fopen: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    if (recorder->format == VIDEO_Y4M) {
+        fprintf(recorder->out, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    }
+
+    atomic_init(&recorder->head, 0);
+    atomic_init(&recorder->tail, 0);
+    atomic_init(&recorder->closing, false);
+    atomic_init(&recorder->frames_dropped, 0);
+
+    if (sem_init(&recorder->pending, 0, 0) == -1) {
+        fprintf(stderr, "%s: sem_init: %s\n", __func__, strerror(errno));
+        if (recorder->out != stdout) {
+            fclose(recorder->out);
+        }
+        return -1;
+    }
+    if (sem_init(&recorder->space, 0, RECORD_QUEUE_LENGTH) == -1) {
+        fprintf(stderr, "%s: sem_init: %s\n", __func__, strerror(errno));
+        sem_destroy(&recorder->pending);
+        if (recorder->out != stdout) {
+            fclose(recorder->out);
+        }
+        return -1;
+    }
+
+    int err = pthread_create(&recorder->thread, NULL, chip8_recorder_main, recorder);
+    if (err != 0) {
+        fprintf(stderr, "%s: pthread_create: %s\n", __func__, strerror(err));
+        sem_destroy(&recorder->pending);
+        sem_destroy(&recorder->space);
+        if (recorder->out != stdout) {
+            fclose(recorder->out);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+// Writes out everything still queued
+int chip8_close_recorder(struct chip8_recorder *recorder, const struct chip8_config *config) {
+    (void) config;
+
+    atomic_store(&recorder->closing, true);
+    sem_post(&recorder->pending);
+    pthread_join(recorder->thread, NULL);
+    sem_destroy(&recorder->pending);
+    sem_destroy(&recorder->space);
+
+    uint64_t dropped = atomic_load(&recorder->frames_dropped);
+    if (dropped > 0) {
+        fprintf(stderr, "%s: dropped %" PRIu64 " frames the writer could not keep up with\n", __func__, dropped);
+    }
+
+    if (fflush(recorder->out) == EOF) {
+        fprintf(stderr, "%s: fflush: %s\n", __func__, strerror(errno));
+        recorder->failed = true;
+    }
+    if (recorder->out != stdout && fclose(recorder->out) == EOF) {
+        fprintf(stderr, "%s: fclose: %s\n", __func__, strerror(errno));
+        recorder->failed = true;
+    }
+    recorder->out = NULL;
+
+    return recorder->failed ? -1 : 0;
+}
+
+// Called by the emulator once per frame
+// With wait set a full queue holds the emulator up until the writer takes a frame, otherwise the frame is dropped
+// A run of dropped frames is reported as it starts and as it ends, the recording has a hole there
+void chip8_record_frame(struct chip8_recorder *recorder, const struct chip8_state *state, uint64_t number, bool wait) {
+    int taken;
+    if (wait) {
+        while ((taken = sem_wait(&recorder->space)) == -1 && errno == EINTR);
+    } else {
+        taken = sem_trywait(&recorder->space);
+    }
+
+    if (taken == -1) {
+        if (!recorder->dropping) {
+            fprintf(stderr, "%s: the writer is behind, dropping frames from %" PRIu64 "\n", __func__, number);
+            recorder->dropping = true;
+        }
+        atomic_fetch_add_explicit(&recorder->frames_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    if (recorder->dropping) {
+        fprintf(stderr, "%s: recording again from frame %" PRIu64 "\n", __func__, number);
+        recorder->dropping = false;
+    }
+
+    uint32_t head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+    chip8_snapshot_frame(&recorder->queue[head % RECORD_QUEUE_LENGTH], state, number);
+    atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+    sem_post(&recorder->pending);
+}
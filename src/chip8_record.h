@@ -0,0 +1,58 @@
+#ifndef CHIP8_RECORD_H
+#define CHIP8_RECORD_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_config.h"
+#include "chip8_frame.h"
+#include "chip8_state.h"
+
+// Frames waiting for the writer, when it is full a real-time emulator drops new frames and a turbo one waits
+#define RECORD_QUEUE_LENGTH 64
+
+enum chip8_video_format {
+    VIDEO_Y4M, // YUV4MPEG2, 4:4:4 at 60 frames per second
+    VIDEO_PPM  // Back to back binary PPM images
+};
+
+struct chip8_recorder {
+    FILE *out;
+    enum chip8_video_format format;
+    bool use_avx2;
+
+    // Single producer, single consumer, head and tail only ever grow
+    struct chip8_frame queue[RECORD_QUEUE_LENGTH];
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    sem_t pending;
+    // Free places in the queue, given back by the writer for every frame it takes
+    sem_t space;
+    _Atomic bool closing;
+
+    pthread_t thread;
+    bool failed;
+
+    // Owned by the writer, an unchanged screen is written again straight from encoded
+    struct chip8_frame previous;
+    bool has_previous;
+    uint8_t encoded[3 * DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    uint32_t pixels[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    uint8_t yuv[1 << SCREEN_PLANES][3];
+
+    uint64_t frames_written;
+    uint64_t frames_repeated;
+    _Atomic uint64_t frames_dropped;
+    // Owned by the emulator, set from the first dropped frame until one is queued again
+    bool dropping;
+};
+
+int chip8_open_recorder(struct chip8_recorder *recorder, const char *path, const struct chip8_config *config);
+int chip8_close_recorder(struct chip8_recorder *recorder, const struct chip8_config *config);
+void chip8_record_frame(struct chip8_recorder *recorder, const struct chip8_state *state, uint64_t number, bool wait);
+
+#endif // CHIP8_RECORD_H
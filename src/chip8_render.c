@@ -0,0 +1,178 @@
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_frame.h"
+#include "chip8_render.h"
+#include "chip8_state.h"
+
+const uint32_t chip8_palette[1 << SCREEN_PLANES] = {0xFF202020, 0xFFF0F0F0, 0xFFE06020, 0xFF904818};
+
+static void chip8_render_lores(uint32_t *pixels, uint64_t row) {
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x++) {
+        pixels[x] = chip8_palette[(row >> (DISPLAY_WIDTH / 2 - 1 - x / 2)) & 1];
+    }
+}
+
+static void chip8_render_single(uint32_t *pixels, chip8_row row) {
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x++) {
+        pixels[x] = chip8_palette[(row >> (DISPLAY_WIDTH - 1 - x)) & 1];
+    }
+}
+
+static void chip8_composite_scalar(uint32_t *pixels, chip8_row plane0, chip8_row plane1) {
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x++) {
+        uint8_t shift = DISPLAY_WIDTH - 1 - x;
+        pixels[x] = chip8_palette[((plane1 >> shift) & 1) << 1 | ((plane0 >> shift) & 1)];
+    }
+}
+
+#ifdef __x86_64__
+// Eight pixels at a time, each lane's palette index picks its colour straight out of a register
+__attribute__((target("avx2")))
+static void chip8_composite_avx2(uint32_t *pixels, chip8_row plane0, chip8_row plane1) {
+    const __m256i palette = _mm256_setr_epi32(chip8_palette[0], chip8_palette[1], chip8_palette[2], chip8_palette[3], 0, 0, 0, 0);
+    const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+
+    for (uint8_t i = 0; i < DISPLAY_WIDTH / 8; i++) {
+        uint8_t shift = DISPLAY_WIDTH - 8 * (i + 1);
+        __m256i bits0 = _mm256_and_si256(_mm256_set1_epi32((uint8_t) (plane0 >> shift)), bits);
+        __m256i bits1 = _mm256_and_si256(_mm256_set1_epi32((uint8_t) (plane1 >> shift)), bits);
+        __m256i index = _mm256_or_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi32(bits0, bits), one),
+            _mm256_and_si256(_mm256_cmpeq_epi32(bits1, bits), two)
+        );
+        _mm256_storeu_si256((__m256i *) &pixels[8 * i], _mm256_permutevar8x32_epi32(palette, index));
+    }
+}
+#endif
+
+static chip8_row chip8_frame_row(const uint8_t *plane, uint8_t y, uint8_t bytes) {
+    chip8_row row = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        row = (row << 8) | plane[y * bytes + i];
+    }
+    return row;
+}
+
+// Expand frame rows first to last into ARGB8888 pixels, pitch bytes apart
+// Programs that never selected plane 1 skip compositing altogether
+void chip8_render_rows(const struct chip8_frame *frame, uint32_t *pixels, int pitch, uint8_t first, uint8_t last, bool use_avx2) {
+    for (uint8_t y = first; y <= last; y++) {
+        uint32_t *row = (uint32_t *) ((uint8_t *) pixels + (y - first) * pitch);
+
+        if (frame->lores) {
+            chip8_render_lores(row, (uint64_t) chip8_frame_row(frame->planes[0], y / 2, DISPLAY_WIDTH / 16));
+        } else if (!frame->multi_plane) {
+            chip8_render_single(row, chip8_frame_row(frame->planes[0], y, DISPLAY_WIDTH / 8));
+        } else {
+            chip8_row plane0 = chip8_frame_row(frame->planes[0], y, DISPLAY_WIDTH / 8);
+            chip8_row plane1 = chip8_frame_row(frame->planes[1], y, DISPLAY_WIDTH / 8);
+#ifdef __x86_64__
+            if (use_avx2) {
+                chip8_composite_avx2(row, plane0, plane1);
+                continue;
+            }
+#endif
+            chip8_composite_scalar(row, plane0, plane1);
+        }
+    }
+}
+
+void chip8_init_phosphor(struct chip8_phosphor *phosphor) {
+    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (uint16_t x = 0; x < DISPLAY_WIDTH; x++) {
+            phosphor->target[y][x] = chip8_palette[0];
+            phosphor->shown[y][x] = chip8_palette[0];
+        }
+    }
+    phosphor->fading_rows = 0;
+}
+
+#ifdef __x86_64__
+// Each channel decays towards the target but never below it, 16 bytes at a time
+// Returns whether the row still differs from the target
+static bool chip8_phosphor_sse(const uint32_t *target, uint32_t *shown, uint32_t *pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i decay = _mm_set1_epi16(PHOSPHOR_DECAY);
+    int same = 0xFFFF;
+
+    for (uint8_t i = 0; i < DISPLAY_WIDTH / 4; i++) {
+        __m128i old = _mm_loadu_si128((const __m128i *) &shown[4 * i]);
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(old, zero), decay), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(old, zero), decay), 8);
+        __m128i want = _mm_loadu_si128((const __m128i *) &target[4 * i]);
+        __m128i now = _mm_max_epu8(_mm_packus_epi16(lo, hi), want);
+
+        _mm_storeu_si128((__m128i *) &shown[4 * i], now);
+        _mm_storeu_si128((__m128i *) &pixels[4 * i], now);
+        same &= _mm_movemask_epi8(_mm_cmpeq_epi8(now, want));
+    }
+
+    return same != 0xFFFF;
+}
+
+__attribute__((target("avx2")))
+static bool chip8_phosphor_avx2(const uint32_t *target, uint32_t *shown, uint32_t *pixels) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i decay = _mm256_set1_epi16(PHOSPHOR_DECAY);
+    __m256i differ = _mm256_setzero_si256();
+
+    for (uint8_t i = 0; i < DISPLAY_WIDTH / 8; i++) {
+        __m256i old = _mm256_loadu_si256((const __m256i *) &shown[8 * i]);
+        __m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(old, zero), decay), 8);
+        __m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(old, zero), decay), 8);
+        __m256i want = _mm256_loadu_si256((const __m256i *) &target[8 * i]);
+        __m256i now = _mm256_max_epu8(_mm256_packus_epi16(lo, hi), want);
+
+        _mm256_storeu_si256((__m256i *) &shown[8 * i], now);
+        _mm256_storeu_si256((__m256i *) &pixels[8 * i], now);
+        differ = _mm256_or_si256(differ, _mm256_xor_si256(now, want));
+    }
+
+    return !_mm256_testz_si256(differ, differ);
+}
+#else
+// The same decay a byte at a time
+static bool chip8_phosphor_scalar(const uint32_t *target, uint32_t *shown, uint32_t *pixels) {
+    bool fading = false;
+
+    for (uint16_t x = 0; x < DISPLAY_WIDTH; x++) {
+        uint32_t now = 0;
+        for (uint8_t shift = 0; shift < 32; shift += 8) {
+            uint32_t decayed = ((shown[x] >> shift) & 0xFF) * PHOSPHOR_DECAY >> 8;
+            uint32_t want = (target[x] >> shift) & 0xFF;
+            now |= ((decayed > want) ? decayed : want) << shift;
+        }
+
+        shown[x] = now;
+        pixels[x] = now;
+        fading |= (now != target[x]);
+    }
+
+    return fading;
+}
+#endif
+
+// Step rows first to last one frame on and write them out as ARGB8888 pixels, pitch bytes apart
+void chip8_blend_phosphor(struct chip8_phosphor *phosphor, uint32_t *pixels, int pitch, uint8_t first, uint8_t last, bool use_avx2) {
+    for (uint8_t y = first; y <= last; y++) {
+        uint32_t *row = (uint32_t *) ((uint8_t *) pixels + (y - first) * pitch);
+
+#ifdef __x86_64__
+        bool fading = use_avx2 ? chip8_phosphor_avx2(phosphor->target[y], phosphor->shown[y], row)
+                               : chip8_phosphor_sse(phosphor->target[y], phosphor->shown[y], row);
+#else
+        bool fading = chip8_phosphor_scalar(phosphor->target[y], phosphor->shown[y], row);
+#endif
+        if (fading) {
+            phosphor->fading_rows |= UINT64_C(1) << y;
+        } else {
+            phosphor->fading_rows &= ~(UINT64_C(1) << y);
+        }
+    }
+}
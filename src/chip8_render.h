@@ -0,0 +1,30 @@
+#ifndef CHIP8_RENDER_H
+#define CHIP8_RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_frame.h"
+#include "chip8_state.h"
+
+// ARGB8888 colour for each pixel value, plane 1 in bit 1 and plane 0 in bit 0
+extern const uint32_t chip8_palette[1 << SCREEN_PLANES];
+
+// Share of a fading pixel's brightness kept each frame, out of 256
+#define PHOSPHOR_DECAY 160
+
+// Lit pixels light up at once and fade out over a few frames, which hides XOR flicker
+struct chip8_phosphor {
+    // What the latest frame shows, and what is on screen
+    uint32_t target[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    uint32_t shown[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+
+    // Rows where shown has not yet caught up with target
+    uint64_t fading_rows;
+};
+
+void chip8_init_phosphor(struct chip8_phosphor *phosphor);
+void chip8_blend_phosphor(struct chip8_phosphor *phosphor, uint32_t *pixels, int pitch, uint8_t first, uint8_t last, bool use_avx2);
+void chip8_render_rows(const struct chip8_frame *frame, uint32_t *pixels, int pitch, uint8_t first, uint8_t last, bool use_avx2);
+
+#endif // CHIP8_RENDER_H
@@ -0,0 +1,225 @@
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "chip8_config.h"
+#include "chip8_display.h"
+#include "chip8_frame.h"
+#include "chip8_render.h"
+#include "chip8_sdl_display.h"
+#include "chip8_state.h"
+
+static int chip8_open_sdl_display(struct chip8_sdl_display *display, const struct chip8_config *config) {
+    display->window = SDL_CreateWindow(
+        "chip8",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        DISPLAY_WIDTH * config->default_scale, DISPLAY_HEIGHT * config->default_scale,
+        SDL_WINDOW_RESIZABLE
+    );
+    if (display->window == NULL) {
+        fprintf(stderr, "SDL_CreateWindow(): %s\n", SDL_GetError());
+        return -1;
+    }
+
+    display->renderer = SDL_CreateRenderer(display->window, -1, 0);
+    if (display->renderer == NULL) {
+        fprintf(stderr, "SDL_CreateRenderer(): %s\n", SDL_GetError());
+        SDL_DestroyWindow(display->window);
+        display->window = NULL;
+        return -1;
+    }
+
+    if (SDL_RenderSetLogicalSize(display->renderer, DISPLAY_WIDTH, DISPLAY_HEIGHT) < 0) {
+        fprintf(stderr, "SDL_RenderSetLogicalSize(): %s\n", SDL_GetError());
+        SDL_DestroyRenderer(display->renderer);
+        SDL_DestroyWindow(display->window);
+        display->renderer = NULL;
+        display->window = NULL;
+        return -1;
+    }
+
+    if (SDL_RenderSetIntegerScale(display->renderer, SDL_TRUE) < 0) {
+        fprintf(stderr, "SDL_RenderSetIntegerScale(): %s\n", SDL_GetError());
+        SDL_DestroyRenderer(display->renderer);
+        SDL_DestroyWindow(display->window);
+        display->renderer = NULL;
+        display->window = NULL;
+        return -1;
+    }
+
+#ifdef __x86_64__
+    display->use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    // Created once and refilled in place every frame
+    display->texture = SDL_CreateTexture(
+        display->renderer,
+        SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        DISPLAY_WIDTH, DISPLAY_HEIGHT
+    );
+    if (display->texture == NULL) {
+        fprintf(stderr, "SDL_CreateTexture(): %s\n", SDL_GetError());
+        SDL_DestroyRenderer(display->renderer);
+        SDL_DestroyWindow(display->window);
+        display->renderer = NULL;
+        display->window = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int chip8_close_sdl_display(struct chip8_display *base, const struct chip8_config *config) {
+    (void) config;
+
+    struct chip8_sdl_display *display = base->backend;
+    SDL_DestroyTexture(display->texture);
+    SDL_DestroyRenderer(display->renderer);
+    SDL_DestroyWindow(display->window);
+    free(display->phosphor);
+    free(display);
+
+    return 0;
+}
+
+static int chip8_update_sdl_display(struct chip8_display *base, const struct chip8_frame *frame, const struct chip8_config *config) {
+    (void) config;
+
+    struct chip8_sdl_display *display = base->backend;
+
+    // Only upload the rows between the first and last that changed, or nothing at all
+    // Without a new frame the texture still holds the last one, unless phosphor rows are still fading
+    uint64_t rows = (frame != NULL) ? frame->dirty_rows : 0;
+    if (display->phosphor != NULL) {
+        rows |= display->phosphor->fading_rows;
+    }
+
+    if (rows != 0) {
+        int first = __builtin_ctzll(rows);
+        int last = 63 - __builtin_clzll(rows);
+        SDL_Rect rect = {0, first, DISPLAY_WIDTH, last - first + 1};
+
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(display->texture, &rect, &pixels, &pitch) < 0) {
+            fprintf(stderr, "SDL_LockTexture(): %s\n", SDL_GetError());
+            return -1;
+        }
+
+        if (display->phosphor == NULL) {
+            chip8_render_rows(frame, pixels, pitch, first, last, display->use_avx2);
+        } else {
+            if (frame != NULL && frame->dirty_rows != 0) {
+                uint8_t dirty_first = __builtin_ctzll(frame->dirty_rows);
+                uint8_t dirty_last = 63 - __builtin_clzll(frame->dirty_rows);
+                chip8_render_rows(frame, &display->phosphor->target[dirty_first][0], sizeof(display->phosphor->target[0]), dirty_first, dirty_last, display->use_avx2);
+            }
+            chip8_blend_phosphor(display->phosphor, pixels, pitch, first, last, display->use_avx2);
+        }
+
+        SDL_UnlockTexture(display->texture);
+    }
+
+    if (SDL_RenderClear(display->renderer) < 0) {
+        fprintf(stderr, "SDL_RenderClear(): %s\n", SDL_GetError());
+        return -1;
+    }
+
+    if (SDL_RenderCopyF(display->renderer, display->texture, NULL, NULL) < 0) {
+        fprintf(stderr, "SDL_RenderCopyF(): %s\n", SDL_GetError());
+        return -1;
+    }
+
+    SDL_RenderPresent(display->renderer);
+
+    return 0;
+}
+
+static int chip8_key_for(SDL_Scancode scancode) {
+    switch (scancode) {
+        case SDL_SCANCODE_1: return 0x1;
+        case SDL_SCANCODE_2: return 0x2;
+        case SDL_SCANCODE_3: return 0x3;
+        case SDL_SCANCODE_4: return 0xC;
+        case SDL_SCANCODE_Q: return 0x4;
+        case SDL_SCANCODE_W: return 0x5;
+        case SDL_SCANCODE_E: return 0x6;
+        case SDL_SCANCODE_R: return 0xD;
+        case SDL_SCANCODE_A: return 0x7;
+        case SDL_SCANCODE_S: return 0x8;
+        case SDL_SCANCODE_D: return 0x9;
+        case SDL_SCANCODE_F: return 0xE;
+        case SDL_SCANCODE_Z: return 0xA;
+        case SDL_SCANCODE_X: return 0x0;
+        case SDL_SCANCODE_C: return 0xB;
+        case SDL_SCANCODE_V: return 0xF;
+        default: return -1;
+    }
+}
+
+static int chip8_poll_sdl_display(struct chip8_display *base, struct chip8_input *input, const struct chip8_config *config) {
+    (void) base;
+    (void) config;
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_KEYDOWN) {
+            int key = chip8_key_for(event.key.keysym.scancode);
+            if (key != -1) {
+                input->keys |= 1u << key;
+            }
+
+            switch (event.key.keysym.scancode) {
+                case SDL_SCANCODE_P: input->toggle_pause = true; break;
+                case SDL_SCANCODE_TAB: input->toggle_turbo = true; break;
+                case SDL_SCANCODE_ESCAPE: input->quit = true; break;
+                default: break;
+            }
+        }
+
+        if (event.type == SDL_KEYUP) {
+            int key = chip8_key_for(event.key.keysym.scancode);
+            if (key != -1) {
+                input->keys &= ~(1u << key);
+            }
+        }
+
+        if (event.type == SDL_QUIT) {
+            input->quit = true;
+        }
+    }
+
+    return 0;
+}
+
+// Needs SDL_Init(SDL_INIT_VIDEO) first
+int chip8_init_sdl_display(struct chip8_display *display, const struct chip8_config *config) {
+    memset(display, 0, sizeof(*display));
+
+    struct chip8_sdl_display *backend = calloc(1, sizeof(*backend));
+    if (backend == NULL) {
+        return -1;
+    }
+
+    if (config->phosphor) {
+        backend->phosphor = malloc(sizeof(*backend->phosphor));
+        if (backend->phosphor == NULL) {
+            free(backend);
+            return -1;
+        }
+        chip8_init_phosphor(backend->phosphor);
+    }
+
+    if (chip8_open_sdl_display(backend, config) == -1) {
+        free(backend->phosphor);
+        free(backend);
+        return -1;
+    }
+
+    display->update = chip8_update_sdl_display;
+    display->poll = chip8_poll_sdl_display;
+    display->close = chip8_close_sdl_display;
+    display->backend = backend;
+
+    return 0;
+}
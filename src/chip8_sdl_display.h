@@ -0,0 +1,23 @@
+#ifndef CHIP8_SDL_DISPLAY_H
+#define CHIP8_SDL_DISPLAY_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+struct chip8_sdl_display {
+    SDL_Renderer *renderer;
+    SDL_Window *window;
+    SDL_Texture *texture;
+    bool use_avx2;
+
+    // NULL unless phosphor persistence is on
+    struct chip8_phosphor *phosphor;
+};
+
+#include "chip8_config.h"
+#include "chip8_display.h"
+#include "chip8_render.h"
+
+int chip8_init_sdl_display(struct chip8_display *display, const struct chip8_config *config);
+
+#endif // CHIP8_SDL_DISPLAY_H
@@ -0,0 +1,278 @@
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8_config.h"
+#include "chip8_sound.h"
+#include "chip8_state.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846L
+#endif
+
+// Volume is baked into the table, so filling is nothing but lookups
+void chip8_init_tone(struct chip8_tone *tone, enum chip8_waveform waveform, double frequency, int sample_rate, float volume) {
+    for (uint32_t i = 0; i < WAVETABLE_LENGTH; i++) {
+        double t = (double) i / WAVETABLE_LENGTH;
+        double value;
+        switch (waveform) {
+            case WAVE_SQUARE:
+                value = (t < 0.5) ? 1.0 : -1.0;
+                break;
+            case WAVE_TRIANGLE:
+                value = (t < 0.25) ? 4.0 * t : (t < 0.75) ? 2.0 - 4.0 * t : 4.0 * t - 4.0;
+                break;
+            case WAVE_SINE:
+            default:
+                value = sin(2.0 * M_PI * t);
+                break;
+        }
+        tone->table[i] = (float) (volume * value);
+    }
+
+    tone->phase = 0;
+    tone->step = (uint32_t) llround(frequency / sample_rate * 4294967296.0);
+#ifdef __x86_64__
+    tone->use_avx2 = __builtin_cpu_supports("avx2");
+#else
+    tone->use_avx2 = false;
+#endif
+
+    // The pattern phase wraps once every 128 bits, so one bit is 2^25 of it
+    for (uint32_t pitch = 0; pitch < 256; pitch++) {
+        double rate = 4000.0 * exp2(((double) pitch - 64.0) / 48.0);
+        tone->pattern_steps[pitch] = (uint32_t) llround(rate / sample_rate * (double) (1u << (32 - AUDIO_PATTERN_BITS)));
+    }
+    tone->pattern_phase = 0;
+    tone->volume = volume;
+    tone->has_pattern = false;
+}
+
+static void chip8_fill_table_scalar(const float *table, int bits, uint32_t *phase, uint32_t step, float *samples, size_t count) {
+    uint32_t p = *phase;
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = table[p >> (32 - bits)];
+        p += step;
+    }
+    *phase = p;
+}
+
+#ifdef __x86_64__
+// Eight phases a step apart, gathered from the table in one go
+__attribute__((target("avx2")))
+static void chip8_fill_table_avx2(const float *table, int bits, uint32_t *phase, uint32_t step, float *samples, size_t count) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i p = _mm256_add_epi32(_mm256_set1_epi32((int32_t) *phase), _mm256_mullo_epi32(lanes, _mm256_set1_epi32((int32_t) step)));
+    const __m256i advance = _mm256_set1_epi32((int32_t) (8 * step));
+    const __m128i shift = _mm_cvtsi32_si128(32 - bits);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_srl_epi32(p, shift);
+        _mm256_storeu_ps(&samples[i], _mm256_i32gather_ps(table, index, sizeof(float)));
+        p = _mm256_add_epi32(p, advance);
+    }
+
+    *phase += (uint32_t) i * step;
+    chip8_fill_table_scalar(table, bits, phase, step, &samples[i], count - i);
+}
+#endif
+
+static void chip8_fill_table(const struct chip8_tone *tone, const float *table, int bits, uint32_t *phase, uint32_t step, float *samples, size_t count) {
+#ifdef __x86_64__
+    if (tone->use_avx2) {
+        chip8_fill_table_avx2(table, bits, phase, step, samples, count);
+        return;
+    }
+#endif
+    chip8_fill_table_scalar(table, bits, phase, step, samples, count);
+}
+
+void chip8_fill_tone(struct chip8_tone *tone, float *samples, size_t count) {
+    chip8_fill_table(tone, tone->table, WAVETABLE_BITS, &tone->phase, tone->step, samples, count);
+}
+
+// Only rebuilt when the program loads a different pattern, most frames just play the cached one
+static void chip8_load_pattern(struct chip8_tone *tone, const uint8_t pattern[AUDIO_PATTERN_BYTES]) {
+    if (tone->has_pattern && memcmp(tone->pattern, pattern, AUDIO_PATTERN_BYTES) == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < AUDIO_PATTERN_LENGTH; i++) {
+        bool bit = (pattern[i / 8] >> (7 - i % 8)) & 1;
+        tone->pattern_table[i] = bit ? tone->volume : -tone->volume;
+    }
+    memcpy(tone->pattern, pattern, AUDIO_PATTERN_BYTES);
+    tone->has_pattern = true;
+}
+
+// Silence keeps the phase where it stopped
+// Once the program has loaded a pattern with F002 it replaces the beeper tone
+static void chip8_fill_sound(struct chip8_tone *tone, const struct chip8_state *state, bool on, float *samples, size_t count) {
+    if (!on) {
+        memset(samples, 0, count * sizeof(*samples));
+    } else if (state->has_pattern) {
+        chip8_load_pattern(tone, state->audio_pattern);
+        chip8_fill_table(tone, tone->pattern_table, AUDIO_PATTERN_BITS, &tone->pattern_phase, tone->pattern_steps[state->pitch], samples, count);
+    } else {
+        chip8_fill_tone(tone, samples, count);
+    }
+}
+
+// What the speaker plays for the frame that just ran
+// Each FX18 edge lands on the sample as far into the frame as its instruction, not on the frame boundary
+void chip8_generate_sound(struct chip8_tone *tone, const struct chip8_state *state, float *samples, size_t count) {
+    if (state->num_sound_edges == 0) {
+        chip8_fill_sound(tone, state, state->sound_timer > 0, samples, count);
+        return;
+    }
+
+    size_t start = 0;
+    for (uint8_t i = 0; i < state->num_sound_edges; i++) {
+        size_t end = count;
+        if (i + 1 < state->num_sound_edges && state->frame_instructions > 0) {
+            uint64_t sample = state->sound_edges[i + 1].instruction * count / state->frame_instructions;
+            end = (sample < start) ? start : (sample > count) ? count : (size_t) sample;
+        }
+        chip8_fill_sound(tone, state, state->sound_edges[i].on, &samples[start], end - start);
+        start = end;
+    }
+}
+
+void chip8_init_sound_ring(struct chip8_sound_ring *ring) {
+    memset(ring->samples, 0, sizeof(ring->samples));
+    atomic_init(&ring->written, 0);
+    atomic_init(&ring->read, 0);
+    ring->dropped = 0;
+    atomic_init(&ring->underruns, 0);
+}
+
+// All or nothing, a block that does not fit is dropped rather than waiting for the reader
+bool chip8_write_sound(struct chip8_sound_ring *ring, const float *samples, size_t count) {
+    uint64_t written = atomic_load_explicit(&ring->written, memory_order_relaxed);
+    uint64_t read = atomic_load_explicit(&ring->read, memory_order_acquire);
+    if (count > SOUND_RING_LENGTH - (written - read)) {
+        ring->dropped++;
+        return false;
+    }
+
+    size_t start = written % SOUND_RING_LENGTH;
+    size_t first = (count < SOUND_RING_LENGTH - start) ? count : SOUND_RING_LENGTH - start;
+    memcpy(&ring->samples[start], samples, first * sizeof(*samples));
+    memcpy(&ring->samples[0], &samples[first], (count - first) * sizeof(*samples));
+
+    atomic_store_explicit(&ring->written, written + count, memory_order_release);
+    return true;
+}
+
+// Fills all count samples, padding with silence past whatever was waiting, and returns how many came from the ring
+size_t chip8_read_sound(struct chip8_sound_ring *ring, float *samples, size_t count) {
+    uint64_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+    uint64_t written = atomic_load_explicit(&ring->written, memory_order_acquire);
+    size_t available = (written - read < count) ? written - read : count;
+
+    size_t start = read % SOUND_RING_LENGTH;
+    size_t first = (available < SOUND_RING_LENGTH - start) ? available : SOUND_RING_LENGTH - start;
+    memcpy(samples, &ring->samples[start], first * sizeof(*samples));
+    memcpy(&samples[first], &ring->samples[0], (available - first) * sizeof(*samples));
+    if (available < count) {
+        memset(&samples[available], 0, (count - available) * sizeof(*samples));
+        atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&ring->read, read + available, memory_order_release);
+    return available;
+}
+
+// Full correction once the ring is this far from its target
+#define RATE_LIMIT 0.005
+#define RATE_RANGE 256.0
+// Frames for a steady error to be fully taken over by the drift term
+#define DRIFT_FRAMES 256.0
+
+// More underruns than this between two frames means the emulator was away, in turbo mode or stopped in a debugger
+// No buffer would have covered that, so the ring is refilled without raising the target
+#define STALL_UNDERRUNS 4
+
+// A target that held for five seconds is tried a little lower
+#define CLEAN_FRAMES 300
+#define GROW_STEP 128
+#define SHRINK_STEP 32
+
+static double clamp_rate(double adjust) {
+    return (adjust > RATE_LIMIT) ? RATE_LIMIT : (adjust < -RATE_LIMIT) ? -RATE_LIMIT : adjust;
+}
+
+// Keeps the ring at least at the target, the audio callback starts out on silence rather than an underrun
+static void chip8_fill_silence(struct chip8_rate_control *rate, struct chip8_sound_ring *ring) {
+    static const float silence[SOUND_MAX_DEPTH];
+
+    uint64_t depth = atomic_load_explicit(&ring->written, memory_order_relaxed) - atomic_load_explicit(&ring->read, memory_order_acquire);
+    if (depth < rate->target) {
+        chip8_write_sound(ring, silence, rate->target - depth);
+    }
+    rate->depth = (double) rate->target;
+}
+
+void chip8_init_rate_control(struct chip8_rate_control *rate, struct chip8_sound_ring *ring) {
+    rate->target = SOUND_MIN_DEPTH;
+    rate->ratio = 1.0;
+    rate->drift = 0.0;
+    rate->fraction = 0.0;
+    rate->started = false;
+    rate->clean_frames = 0;
+    rate->low_water = UINT64_MAX;
+    chip8_fill_silence(rate, ring);
+}
+
+// Number of samples to generate for the next frame, called by the writer before every chip8_write_sound
+size_t chip8_pace_sound(struct chip8_rate_control *rate, struct chip8_sound_ring *ring) {
+    // The device was already running before the first frame, what it missed then says nothing about the target
+    uint64_t underruns = atomic_load_explicit(&ring->underruns, memory_order_relaxed);
+    uint64_t missed = rate->started ? underruns - rate->underruns : 1;
+    rate->underruns = underruns;
+
+    if (missed > 0) {
+        if (missed <= STALL_UNDERRUNS && rate->started) {
+            rate->target = (rate->target + GROW_STEP < SOUND_MAX_DEPTH) ? rate->target + GROW_STEP : SOUND_MAX_DEPTH;
+        }
+        rate->started = true;
+        rate->clean_frames = 0;
+        rate->low_water = UINT64_MAX;
+        chip8_fill_silence(rate, ring);
+    }
+
+    uint64_t depth = atomic_load_explicit(&ring->written, memory_order_relaxed) - atomic_load_explicit(&ring->read, memory_order_acquire);
+
+    // Lower the target only when the ring never came close enough to empty for the step to cause an underrun
+    rate->low_water = (depth < rate->low_water) ? depth : rate->low_water;
+    if (missed == 0 && ++rate->clean_frames >= CLEAN_FRAMES) {
+        if (rate->low_water >= SHRINK_STEP && rate->target > SOUND_MIN_DEPTH) {
+            rate->target -= SHRINK_STEP;
+        }
+        rate->clean_frames = 0;
+        rate->low_water = UINT64_MAX;
+    }
+
+    // The callback takes whole device buffers, so the depth is smoothed over a few frames before steering by it
+    rate->depth += ((double) depth - rate->depth) / 16.0;
+
+    // Steering by the error alone would leave the ring off target by however much the clocks differ
+    // The drift term slowly learns that difference, so the error itself can settle at zero
+    double error = (rate->depth - (double) rate->target) / RATE_RANGE;
+    error = (error > 1.0) ? 1.0 : (error < -1.0) ? -1.0 : error;
+    rate->drift = clamp_rate(rate->drift + RATE_LIMIT * error / DRIFT_FRAMES);
+    rate->ratio = 1.0 - clamp_rate(RATE_LIMIT * error + rate->drift);
+
+    // Carry the fraction over so the average is exact
+    rate->fraction += SOUND_FRAME_SAMPLES * rate->ratio;
+    size_t count = (size_t) rate->fraction;
+    rate->fraction -= (double) count;
+    return count;
+}
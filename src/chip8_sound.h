@@ -0,0 +1,96 @@
+#ifndef CHIP8_SOUND_H
+#define CHIP8_SOUND_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_config.h"
+#include "chip8_state.h"
+
+// Sound is produced by the emulator a frame at a time, 735 samples per 60 Hz frame
+#define SOUND_SAMPLE_RATE 44100
+#define SOUND_FRAME_SAMPLES (SOUND_SAMPLE_RATE / 60)
+
+// The beeper, whether played or captured
+#define SOUND_FREQUENCY 500.0
+#define SOUND_VOLUME 0.8f
+
+// About 46 ms, which is also the most the sound can lag behind the emulator
+#define SOUND_RING_LENGTH 2048
+
+// Low latency mode keeps the ring only as full as the device needs, starting at about 12 ms with the device buffer
+#define SOUND_LOW_LATENCY_SAMPLES 256
+#define SOUND_MIN_DEPTH 256
+#define SOUND_MAX_DEPTH 768
+// The most samples a frame is stretched to, see chip8_rate_control
+#define SOUND_MAX_FRAME_SAMPLES (SOUND_FRAME_SAMPLES + 8)
+
+// One cycle of the waveform, a power of two so the top bits of the phase index it directly
+#define WAVETABLE_BITS 10
+#define WAVETABLE_LENGTH (1 << WAVETABLE_BITS)
+
+// XO-CHIP audio patterns, 16 bytes of one-bit samples played most significant bit first
+#define AUDIO_PATTERN_BITS 7
+#define AUDIO_PATTERN_LENGTH (1 << AUDIO_PATTERN_BITS)
+#define AUDIO_PATTERN_BYTES (AUDIO_PATTERN_LENGTH / 8)
+
+// A tone read out of a wavetable with a 32-bit phase accumulator
+// The phase wraps at exactly one cycle, so it never overflows and never jumps however long it plays
+struct chip8_tone {
+    float table[WAVETABLE_LENGTH];
+    uint32_t phase;
+    uint32_t step;
+    bool use_avx2;
+
+    // The last pattern loaded by the program, expanded to samples, and its phase step for every pitch
+    float pattern_table[AUDIO_PATTERN_LENGTH];
+    uint8_t pattern[AUDIO_PATTERN_BYTES];
+    bool has_pattern;
+    uint32_t pattern_phase;
+    uint32_t pattern_steps[256];
+    float volume;
+};
+
+// Samples from the emulation thread to the audio callback, one writer and one reader
+// Both counters only ever grow, the difference is what is waiting to be played
+struct chip8_sound_ring {
+    float samples[SOUND_RING_LENGTH];
+    _Atomic uint64_t written;
+    _Atomic uint64_t read;
+
+    // Frames that did not fit, owned by the writer
+    uint64_t dropped;
+    // Reads that ran out and were padded with silence, counted by the reader
+    _Atomic uint64_t underruns;
+};
+
+// Decides how many samples each emulated frame produces, so the 60 Hz frames and the device clock never drift apart
+// Frames are stretched or squeezed by at most half a percent, far too little to hear
+struct chip8_rate_control {
+    // Samples the ring should hold when a frame is written, raised after underruns and lowered while all goes well
+    size_t target;
+    double depth;
+    double ratio;
+    double drift;
+    double fraction;
+
+    bool started;
+    uint64_t underruns;
+    uint64_t clean_frames;
+    uint64_t low_water;
+};
+
+void chip8_init_tone(struct chip8_tone *tone, enum chip8_waveform waveform, double frequency, int sample_rate, float volume);
+void chip8_fill_tone(struct chip8_tone *tone, float *samples, size_t count);
+void chip8_generate_sound(struct chip8_tone *tone, const struct chip8_state *state, float *samples, size_t count);
+
+void chip8_init_sound_ring(struct chip8_sound_ring *ring);
+bool chip8_write_sound(struct chip8_sound_ring *ring, const float *samples, size_t count);
+size_t chip8_read_sound(struct chip8_sound_ring *ring, float *samples, size_t count);
+
+void chip8_init_rate_control(struct chip8_rate_control *rate, struct chip8_sound_ring *ring);
+size_t chip8_pace_sound(struct chip8_rate_control *rate, struct chip8_sound_ring *ring);
+
+#endif // CHIP8_SOUND_H
@@ -1,18 +1,26 @@
+#include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
+#include "chip8_analysis.h"
+#include "chip8_aot.h"
 #include "chip8_config.h"
 #include "chip8_exec.h"
+#include "chip8_jit.h"
 #include "chip8_state.h"
 #include "helper.h"
 
 #define bits16(x, size, num) ((uint16_t) (((x) >> (num)) & ((1 << (size)) - 1)))
 #define HISTORY_MAX (60 * 60)
+#define MAX_PROGRAM_LENGTH (sizeof(((struct chip8_state *) NULL)->memory) - PROGRAM_MEMORY_OFFSET)
+// Bump whenever the layout written by chip8_dump_state changes
+#define SAVESTATE_VERSION 1
 
 //static struct chip8_state base_state;
 //static struct chip8_state_compressed g_history[HISTORY_MAX];
@@ -78,18 +86,45 @@ int chip8_init_state(struct chip8_state *state, const struct chip8_config *confi
         return -1;
     }
 
+    state->jit = NULL;
+    state->rng_seed = 0;
+#ifdef CHIP8_JIT
+    state->jit = malloc(sizeof(*state->jit));
+    if (state->jit == NULL) {
+        free(state->stack);
+        return -1;
+    }
+    if (chip8_init_jit(state->jit, config) == -1) {
+        free(state->jit);
+        free(state->stack);
+        return -1;
+    }
+#endif
+
     return chip8_reset_state(state, config);
 }
 
 int chip8_reset_state(struct chip8_state *state, const struct chip8_config *config) {
     uint16_t stack_size = state->stack_size;
     uint16_t *stack = state->stack;
+    struct chip8_jit *jit = state->jit;
+    uint64_t rng_seed = state->rng_seed;
 
     memset(state, 0, sizeof(*state));
 
     state->pc = PROGRAM_MEMORY_OFFSET;
     state->stack = stack;
     state->stack_size = stack_size;
+    state->jit = jit;
+    state->dirty_rows = UINT64_MAX;
+    state->lores_native = true;
+    state->planes = 1;
+    state->pitch = 64;
+    chip8_seed_state(state, rng_seed);
+
+    if (state->jit != NULL) {
+        chip8_flush_jit(state->jit);
+    }
 
     const uint8_t lores_font[] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0,
@@ -136,13 +171,193 @@ int chip8_reset_state(struct chip8_state *state, const struct chip8_config *conf
 }
 
 int chip8_close_state(struct chip8_state *state, const struct chip8_config *config) {
+    if (state->jit != NULL) {
+        chip8_close_jit(state->jit, config);
+        free(state->jit);
+    }
     free(state->stack);
     return 0;
 }
 
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// Seed the CXNN generator, the seed survives resets so a run can be replayed
+void chip8_seed_state(struct chip8_state *state, uint64_t seed) {
+    state->rng_seed = seed;
+    for (uint8_t i = 0; i < 4; i++) {
+        state->rng[i] = splitmix64(&seed);
+    }
+}
+
+uint8_t chip8_random(struct chip8_state *state) {
+    uint64_t *s = state->rng;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result >> 56;
+}
+
+static int fread_all(uint8_t *buf, size_t length, FILE *f) {
+    size_t read = 0;
+
+    while (read < length) {
+        size_t r = fread(&buf[read], sizeof(*buf), length - read, f);
+        if (r == 0) {
+            fprintf(stderr, "%s: fread failed\n", __func__);
+            return -1;
+        }
+        read += r;
+    }
+
+    return 0;
+}
+
+int chip8_load_program(struct chip8_state *state, const struct chip8_config *config, const char *file) {
+    (void) config;
+
+    struct stat file_info;
+    if (stat(file, &file_info) == -1) {
+        fprintf(stderr, "%s: stat: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    if (file_info.st_size > MAX_PROGRAM_LENGTH) {
+        fprintf(stderr, "%s: program must not exceed %zu bytes\n", __func__, (size_t) MAX_PROGRAM_LENGTH);
+        return -1;
+    }
+
+    FILE *f = fopen(file, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: fopen: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    if (fread_all(&state->memory[PROGRAM_MEMORY_OFFSET], file_info.st_size, f) == -1) {
+        fclose(f);
+        return -1;
+    }
+    memset(&state->memory[PROGRAM_MEMORY_OFFSET + file_info.st_size], 0, MAX_PROGRAM_LENGTH - file_info.st_size);
+    state->analysis = chip8_analyze(state->memory, PROGRAM_MEMORY_OFFSET + file_info.st_size);
+    chip8_decode_memory(state);
+    state->aot = chip8_find_aot(&state->memory[PROGRAM_MEMORY_OFFSET], file_info.st_size);
+    if (state->jit != NULL) {
+        chip8_flush_jit(state->jit);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// Double every pixel of a lores row
+static chip8_row chip8_double_row(uint64_t row) {
+    chip8_row doubled = 0;
+    for (int i = 63; i >= 0; i--) {
+        doubled = (doubled << 2) | (((row >> i) & 1) * 3);
+    }
+    return doubled;
+}
+
+// Screen row y at hires resolution, whichever plane holds the picture
+chip8_row chip8_get_screen_row(const struct chip8_state *state, uint8_t y) {
+    if (state->lores_native) {
+        return chip8_double_row(state->lores_screen[y / 2]);
+    }
+    return chip8_screen_row(state, y);
+}
+
+// Move the picture from the lores plane to the hires rows, for anything the lores plane cannot represent
+void chip8_expand_lores(struct chip8_state *state) {
+    if (!state->lores_native) {
+        return;
+    }
+
+    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++) {
+        state->screen[0][y] = chip8_double_row(state->lores_screen[y / 2]);
+    }
+    state->screen_origin[0] = 0;
+    state->lores_native = false;
+}
+
+// Move the picture back to the lores plane if every pixel is still a 2x2 block
+void chip8_compact_lores(struct chip8_state *state) {
+    if (state->lores_native) {
+        return;
+    }
+
+    const chip8_row low_bits = ((chip8_row) 0x5555555555555555 << 64) | 0x5555555555555555;
+    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y += 2) {
+        chip8_row row = chip8_screen_row(state, y);
+        if (row != chip8_screen_row(state, y + 1) || ((row ^ (row >> 1)) & low_bits) != 0) {
+            return;
+        }
+    }
+
+    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y += 2) {
+        chip8_row row = chip8_screen_row(state, y);
+        uint64_t halved = 0;
+        for (int i = 63; i >= 0; i--) {
+            halved = (halved << 1) | (uint64_t) ((row >> (2 * i)) & 1);
+        }
+        state->lores_screen[y / 2] = halved;
+    }
+    state->lores_native = true;
+}
+
+// Convert a plane to and from the flat one bit per pixel layout used by save states
+void chip8_pack_plane(const struct chip8_state *state, uint8_t plane, uint8_t *screen) {
+    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++) {
+        chip8_row row = (plane == 0) ? chip8_get_screen_row(state, y) : chip8_plane_row(state, plane, y);
+        for (int i = DISPLAY_WIDTH / 8 - 1; i >= 0; i--) {
+            screen[y * DISPLAY_WIDTH / 8 + i] = (uint8_t) row;
+            row >>= 8;
+        }
+    }
+}
+
+void chip8_unpack_plane(struct chip8_state *state, uint8_t plane, const uint8_t *screen) {
+    state->screen_origin[plane] = 0;
+    if (plane == 0) {
+        state->lores_native = false;
+    }
+    for (uint8_t y = 0; y < DISPLAY_HEIGHT; y++) {
+        chip8_row row = 0;
+        for (uint8_t i = 0; i < DISPLAY_WIDTH / 8; i++) {
+            row = (row << 8) | screen[y * DISPLAY_WIDTH / 8 + i];
+        }
+        state->screen[plane][y] = row;
+    }
+    state->dirty_rows = UINT64_MAX;
+}
+
+void chip8_pack_screen(const struct chip8_state *state, uint8_t *screen) {
+    chip8_pack_plane(state, 0, screen);
+}
+
+void chip8_unpack_screen(struct chip8_state *state, const uint8_t *screen) {
+    chip8_unpack_plane(state, 0, screen);
+}
+
 int chip8_dump_state(FILE *f, const struct chip8_state *state, const struct chip8_config *config) {
+    if (serialize_16(f, SAVESTATE_VERSION) == -1) return -1;
     if (fwrite(&state->memory,    sizeof(state->memory),    1, f) == 0) return -1;
-    if (fwrite(&state->screen,    sizeof(state->screen),    1, f) == 0) return -1;
+    uint8_t screen[SCREEN_BYTES];
+    chip8_pack_screen(state, screen);
+    if (fwrite(screen, sizeof(screen), 1, f) == 0) return -1;
     if (fwrite(&state->registers, sizeof(state->registers), 1, f) == 0) return -1;
 
     if (serialize_16(f, state->index_register) == -1) return -1;
@@ -163,12 +378,48 @@ int chip8_dump_state(FILE *f, const struct chip8_state *state, const struct chip
         }
     }
 
+    if (serialize_64(f, state->rng_seed) == -1) return -1;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (serialize_64(f, state->rng[i]) == -1) {
+            return -1;
+        }
+    }
+
+    uint8_t multi_plane = state->multi_plane;
+    if (fwrite(&state->planes, sizeof(state->planes), 1, f) == 0) return -1;
+    if (fwrite(&multi_plane,   sizeof(multi_plane),   1, f) == 0) return -1;
+    chip8_pack_plane(state, 1, screen);
+    if (fwrite(screen, sizeof(screen), 1, f) == 0) return -1;
+
+    uint8_t has_pattern = state->has_pattern;
+    if (fwrite(&state->audio_pattern, sizeof(state->audio_pattern), 1, f) == 0) return -1;
+    if (fwrite(&state->pitch,         sizeof(state->pitch),         1, f) == 0) return -1;
+    if (fwrite(&has_pattern,          sizeof(has_pattern),          1, f) == 0) return -1;
+
     return 0;
 }
 
 int chip8_load_state(FILE *f, struct chip8_state *state, const struct chip8_config *config) {
+    uint16_t version;
+    if (deserialize_16(f, &version) == -1) return -1;
+    if (version != SAVESTATE_VERSION) {
+        fprintf(stderr, "%s: unsupported savestate version %" PRIu16 "\n", __func__, version);
+        return -1;
+    }
+
     if (fread(&state->memory,    sizeof(state->memory),    1, f) == 0) return -1;
-    if (fread(&state->screen,    sizeof(state->screen),    1, f) == 0) return -1;
+    // The ROM length is not saved, so the restored image runs without analysis or AOT code
+    state->analysis = NULL;
+    state->aot = NULL;
+    state->num_sound_edges = 0;
+    memset(state->decoded, 0, sizeof(state->decoded));
+    if (state->jit != NULL) {
+        chip8_flush_jit(state->jit);
+    }
+
+    uint8_t screen[SCREEN_BYTES];
+    if (fread(screen, sizeof(screen), 1, f) == 0) return -1;
+    chip8_unpack_screen(state, screen);
     if (fread(&state->registers, sizeof(state->registers), 1, f) == 0) return -1;
 
     if (deserialize_16(f, &state->index_register) == -1) return -1;
@@ -191,13 +442,123 @@ int chip8_load_state(FILE *f, struct chip8_state *state, const struct chip8_conf
         }
     }
 
+    if (deserialize_64(f, &state->rng_seed) == -1) return -1;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (deserialize_64(f, &state->rng[i]) == -1) {
+            return -1;
+        }
+    }
+
+    uint8_t multi_plane;
+    if (fread(&state->planes, sizeof(state->planes), 1, f) == 0) return -1;
+    if (fread(&multi_plane,   sizeof(multi_plane),   1, f) == 0) return -1;
+    state->multi_plane = (multi_plane != 0);
+    if (fread(screen, sizeof(screen), 1, f) == 0) return -1;
+    chip8_unpack_plane(state, 1, screen);
+
+    uint8_t has_pattern;
+    if (fread(&state->audio_pattern, sizeof(state->audio_pattern), 1, f) == 0) return -1;
+    if (fread(&state->pitch,         sizeof(state->pitch),         1, f) == 0) return -1;
+    if (fread(&has_pattern,          sizeof(has_pattern),          1, f) == 0) return -1;
+    state->has_pattern = (has_pattern != 0);
+
     return 0;
 }
 
+// Decode the whole of memory up front, or only the reachable code when the ROM has been analysed
+// Anything skipped is still decoded lazily if it is ever executed
+void chip8_decode_memory(struct chip8_state *state) {
+    for (uint16_t i = 0; i < sizeof(state->memory) / 2; i++) {
+        if (state->analysis != NULL && !(state->analysis->flags[2 * i] & ANALYSIS_INSTRUCTION)) {
+            state->decoded[i].handler = NULL;
+            continue;
+        }
+        chip8_decode(&state->decoded[i], get_opcode(state->memory, 2 * i));
+    }
+}
+
+// Must be called whenever memory is written so stale instructions are decoded again
+void chip8_invalidate_decoded(struct chip8_state *state, uint16_t address, uint16_t length) {
+    state->memory_writes++;
+
+    for (uint16_t i = 0; i < length; i++) {
+        state->decoded[((address + i) & 0xFFF) / 2].handler = NULL;
+    }
+
+    if (state->jit != NULL) {
+        chip8_invalidate_jit(state->jit, address, length);
+    }
+}
+
 int chip8_advance_state(struct chip8_state *state, const struct chip8_config *config) {
-    uint16_t instruction = ((uint16_t) state->memory[state->pc]) << 8 | state->memory[state->pc + 1];
+    struct chip8_instruction scratch;
+    const struct chip8_instruction *inst = chip8_fetch(state, &scratch);
+
+    return inst->handler(state, config, inst);
+}
+
+// Execute up to count instructions and return how many ran, or -1 on error
+// Stops early and sets idle when the program reaches a wait loop, since the rest of the batch could not change anything
+int64_t chip8_advance_state_batch(struct chip8_state *state, const struct chip8_config *config, uint64_t count) {
+    state->idle = false;
+
+    if (state->aot != NULL) {
+        return chip8_run_aot(state, config, count);
+    }
+
+#if defined(CHIP8_JIT)
+    return chip8_run_jit(state, config, count);
+#elif defined(CHIP8_THREADED_DISPATCH)
+    return chip8_exec_threaded(state, config, count);
+#else
+    for (uint64_t i = 0; i < count; i++) {
+        struct chip8_instruction scratch;
+        const struct chip8_instruction *inst = chip8_fetch(state, &scratch);
+
+        if (chip8_op_may_idle(inst->op) && chip8_is_idle(state)) {
+            state->idle = true;
+            return (int64_t) i;
+        }
+        if (chip8_op_uses_clock(inst->op)) {
+            state->batch_clock = i;
+        }
+
+        if (inst->handler(state, config, inst) == -1) {
+            return -1;
+        }
+    }
+    return (int64_t) count;
+#endif
+}
+
+// Number of instructions run during a 60 Hz frame
+// target_speed instructions are spread evenly over each second of frames
+uint64_t chip8_frame_instructions(const struct chip8_config *config, uint64_t frame_number) {
+    uint64_t second_frame = frame_number % 60;
+    return config->target_speed * (second_frame + 1) / 60 - config->target_speed * second_frame / 60;
+}
+
+// Run one frame worth of instructions, then tick the timers
+// Returns how many instructions ran, fewer than the frame's share once the program is idle, or -1 on error
+int64_t chip8_advance_frame(struct chip8_state *state, const struct chip8_config *config, uint64_t frame_number) {
+    state->frame_instructions = chip8_frame_instructions(config, frame_number);
+    state->num_sound_edges = 1;
+    state->sound_edges[0] = (struct chip8_sound_edge) {0, state->sound_timer > 0};
+
+    int64_t executed = chip8_advance_state_batch(state, config, state->frame_instructions);
+    if (executed == -1) {
+        return -1;
+    }
+
+    if (state->delay_timer > 0) {
+        state->delay_timer--;
+    }
+
+    if (state->sound_timer > 0) {
+        state->sound_timer--;
+    }
 
-    return chip8_exec(state, config, instruction);
+    return executed;
 }
 
 int chip8_rewind_state(struct chip8_state *state, const struct chip8_config *config);
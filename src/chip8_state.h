@@ -16,16 +16,88 @@
 #define HIRES_FONT_LENGTH (16 * 10)
 #define PROGRAM_MEMORY_OFFSET 0x200
 
+// XO-CHIP has two bitplanes, plane 0 is the only one classic programs use
+#define SCREEN_PLANES 2
+
+// Size of a plane packed one bit per pixel, row by row, leftmost pixel in the top bit
+#define SCREEN_BYTES (DISPLAY_WIDTH * DISPLAY_HEIGHT / 8)
+
+// Beeper changes kept per frame, any more move the last one
+#define SOUND_MAX_EDGES 16
+
+// Row y of a plane, counted from the top of the visible screen
+#define chip8_plane_row(state, plane, y) ((state)->screen[plane][((state)->screen_origin[plane] + (y)) % DISPLAY_HEIGHT])
+#define chip8_screen_row(state, y) chip8_plane_row(state, 0, y)
+
+struct chip8_state;
+struct chip8_instruction;
+struct chip8_jit;
+struct chip8_aot_program;
+struct chip8_analysis;
+
+// The beeper switching on or off, at the number of instructions the frame had run before the FX18 that did it
+struct chip8_sound_edge {
+    uint64_t instruction;
+    bool on;
+};
+
+// One screen row, the leftmost pixel in the top bit
+__extension__ typedef unsigned __int128 chip8_row;
+
+typedef int chip8_handler(struct chip8_state *state, const struct chip8_config *config, const struct chip8_instruction *inst);
+
+// An opcode split into its handler and operands so it only has to be decoded once
+struct chip8_instruction {
+    chip8_handler *handler;
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t nn;
+};
+
 struct chip8_state {
     uint8_t memory[4096];
 
-    uint8_t screen[DISPLAY_WIDTH * DISPLAY_HEIGHT / 8];
+    // Rows are stored circularly starting at screen_origin, so vertical scrolls only move the origin
+    chip8_row screen[SCREEN_PLANES][DISPLAY_HEIGHT];
+    uint8_t screen_origin[SCREEN_PLANES];
     bool hires;
 
+    // Bit p is set when plane p is affected by drawing, scrolling and clearing, see FN01
+    uint8_t planes;
+    // Set once FN01 selects plane 1, until then plane 0 holds the whole picture
+    bool multi_plane;
+
+    // While lores_native is set the picture is this 64x32 plane with every pixel shown 2x2, and screen is unused
+    uint64_t lores_screen[DISPLAY_HEIGHT / 2];
+    bool lores_native;
+
+    // Bit y is set when screen row y changed since the display last showed it
+    uint64_t dirty_rows;
+
     uint8_t registers[16];
     uint16_t index_register;
     uint8_t delay_timer;
     uint8_t sound_timer;
+
+    // XO-CHIP sound, a loop of 128 one-bit samples played at 4000 * 2^((pitch - 64) / 48) Hz, see F002 and FX3A
+    uint8_t audio_pattern[16];
+    uint8_t pitch;
+    // Set once F002 loads a pattern, until then the beeper plays its usual tone
+    bool has_pattern;
+
+    // Whether the beeper sounded as the last frame started, then every change FX18 made during it
+    // Empty until chip8_advance_frame runs, the sound then follows the timer alone
+    uint8_t num_sound_edges;
+    struct chip8_sound_edge sound_edges[SOUND_MAX_EDGES];
+    // Instructions the last frame was given, the edges are placed in proportion to it
+    uint64_t frame_instructions;
+    // Instructions the running batch completed before the current one, only kept up to date for chip8_op_uses_clock
+    uint64_t batch_clock;
+
     uint16_t pc;
     uint8_t rpl_flags[16];
 
@@ -37,6 +109,28 @@ struct chip8_state {
 
     bool paused;
     bool stopped;
+
+    // xoshiro256** generator behind CXNN, reseeded from rng_seed on reset
+    uint64_t rng_seed;
+    uint64_t rng[4];
+
+    // Set when the last batch stopped early because the program was waiting
+    bool idle;
+
+    // Decoded instruction at each even address, invalid while handler is NULL
+    struct chip8_instruction decoded[4096 / 2];
+
+    // Bumped on every write to memory through chip8_invalidate_decoded
+    uint32_t memory_writes;
+
+    // Native code cache, only allocated when built with JIT=1
+    struct chip8_jit *jit;
+
+    // Ahead-of-time compiled version of the loaded ROM, if it was built in
+    const struct chip8_aot_program *aot;
+
+    // Control flow of the loaded ROM, shared between every state that loaded it
+    const struct chip8_analysis *analysis;
 };
 
 int chip8_stack_resize(struct chip8_state *state, const struct chip8_config *config, uint16_t new_size);
@@ -47,10 +141,29 @@ int chip8_init_state(struct chip8_state *state, const struct chip8_config *confi
 int chip8_reset_state(struct chip8_state *state, const struct chip8_config *config);
 int chip8_close_state(struct chip8_state *state, const struct chip8_config *config);
 
+void chip8_seed_state(struct chip8_state *state, uint64_t seed);
+uint8_t chip8_random(struct chip8_state *state);
+
+int chip8_load_program(struct chip8_state *state, const struct chip8_config *config, const char *file);
+
+chip8_row chip8_get_screen_row(const struct chip8_state *state, uint8_t y);
+void chip8_expand_lores(struct chip8_state *state);
+void chip8_compact_lores(struct chip8_state *state);
+void chip8_pack_plane(const struct chip8_state *state, uint8_t plane, uint8_t *screen);
+void chip8_unpack_plane(struct chip8_state *state, uint8_t plane, const uint8_t *screen);
+void chip8_pack_screen(const struct chip8_state *state, uint8_t *screen);
+void chip8_unpack_screen(struct chip8_state *state, const uint8_t *screen);
+
 int chip8_dump_state(FILE *f, const struct chip8_state *state, const struct chip8_config *config);
 int chip8_load_state(FILE *f, struct chip8_state *state, const struct chip8_config *config);
 
+void chip8_decode_memory(struct chip8_state *state);
+void chip8_invalidate_decoded(struct chip8_state *state, uint16_t address, uint16_t length);
+
 int chip8_advance_state(struct chip8_state *state, const struct chip8_config *config);
+int64_t chip8_advance_state_batch(struct chip8_state *state, const struct chip8_config *config, uint64_t count);
+uint64_t chip8_frame_instructions(const struct chip8_config *config, uint64_t frame_number);
+int64_t chip8_advance_frame(struct chip8_state *state, const struct chip8_config *config, uint64_t frame_number);
 int chip8_rewind_state(struct chip8_state *state, const struct chip8_config *config);
 
 #endif // CHIP8_STATE_H
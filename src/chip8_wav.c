@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_config.h"
+#include "chip8_sound.h"
+#include "chip8_state.h"
+#include "chip8_wav.h"
+
+#define WAV_HEADER_BYTES 44
+
+static void put_le16(uint8_t *out, uint16_t value) {
+    out[0] = (uint8_t) value;
+    out[1] = (uint8_t) (value >> 8);
+}
+
+static void put_le32(uint8_t *out, uint32_t value) {
+    put_le16(out, (uint16_t) value);
+    put_le16(out + 2, (uint16_t) (value >> 16));
+}
+
+// Sizes of 0xFFFFFFFF stand for unknown, which is what a stream that cannot be rewound ends up with
+static int chip8_write_wav_header(FILE *out, uint32_t data_bytes) {
+    uint8_t header[WAV_HEADER_BYTES];
+    uint32_t riff_bytes = (data_bytes == UINT32_MAX) ? UINT32_MAX : data_bytes + WAV_HEADER_BYTES - 8;
+
+    memcpy(&header[0], "RIFF", 4);
+    put_le32(&header[4], riff_bytes);
+    memcpy(&header[8], "WAVEfmt ", 8);
+    put_le32(&header[16], 16);
+    put_le16(&header[20], 1); // PCM
+    put_le16(&header[22], 1); // Mono
+    put_le32(&header[24], SOUND_SAMPLE_RATE);
+    put_le32(&header[28], SOUND_SAMPLE_RATE * sizeof(int16_t));
+    put_le16(&header[32], sizeof(int16_t));
+    put_le16(&header[34], 16);
+    memcpy(&header[36], "data", 4);
+    put_le32(&header[40], data_bytes);
+
+    if (fwrite(header, sizeof(header), 1, out) != 1) {
+        fprintf(stderr, "%s: fwrite: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// path is a file name, - for standard output, or NULL to keep the samples in memory
+int chip8_open_wav(struct chip8_wav *wav, const char *path, const struct chip8_config *config) {
+    memset(wav, 0, sizeof(*wav));
+    wav->hash = 0xCBF29CE484222325;
+    chip8_init_tone(&wav->tone, config->waveform, SOUND_FREQUENCY, SOUND_SAMPLE_RATE, SOUND_VOLUME);
+
+    if (path == NULL) {
+        return 0;
+    }
+
+    wav->out = (strcmp(path, "-") == 0) ? stdout : fopen(path, "wb");
+    if (wav->out == NULL) {
+        fprintf(stderr, "%s: fopen: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    // The sizes are filled in on close if the file can be rewound
+    if (chip8_write_wav_header(wav->out, UINT32_MAX) == -1) {
+        if (wav->out != stdout) {
+            fclose(wav->out);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+int chip8_close_wav(struct chip8_wav *wav, const struct chip8_config *config) {
+    (void) config;
+
+    free(wav->samples);
+    wav->samples = NULL;
+    wav->length = 0;
+    wav->capacity = 0;
+
+    if (wav->out == NULL) {
+        return wav->failed ? -1 : 0;
+    }
+
+    if (wav->out != stdout && !wav->failed && wav->data_bytes <= UINT32_MAX - WAV_HEADER_BYTES) {
+        if (fseek(wav->out, 0, SEEK_SET) == 0) {
+            wav->failed = (chip8_write_wav_header(wav->out, (uint32_t) wav->data_bytes) == -1);
+        }
+    }
+
+    if (fflush(wav->out) == EOF) {
+        fprintf(stderr, "%s: fflush: %s\n", __func__, strerror(errno));
+        wav->failed = true;
+    }
+    if (wav->out != stdout && fclose(wav->out) == EOF) {
+        fprintf(stderr, "%s: fclose: %s\n", __func__, strerror(errno));
+        wav->failed = true;
+    }
+    wav->out = NULL;
+
+    return wav->failed ? -1 : 0;
+}
+
+// Called once per emulated frame, after chip8_advance_frame
+int chip8_write_wav_frame(struct chip8_wav *wav, const struct chip8_state *state) {
+    float samples[SOUND_FRAME_SAMPLES];
+    int16_t pcm[SOUND_FRAME_SAMPLES];
+    uint8_t bytes[sizeof(pcm)];
+
+    chip8_generate_sound(&wav->tone, state, samples, SOUND_FRAME_SAMPLES);
+    for (size_t i = 0; i < SOUND_FRAME_SAMPLES; i++) {
+        pcm[i] = (int16_t) lrintf(samples[i] * INT16_MAX);
+        put_le16(&bytes[2 * i], (uint16_t) pcm[i]);
+    }
+
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        wav->hash ^= bytes[i];
+        wav->hash *= 0x100000001B3;
+    }
+
+    if (wav->out != NULL) {
+        if (!wav->failed && fwrite(bytes, sizeof(bytes), 1, wav->out) != 1) {
+            fprintf(stderr, "%s: fwrite: %s\n", __func__, strerror(errno));
+            wav->failed = true;
+        }
+        wav->data_bytes += sizeof(bytes);
+        return wav->failed ? -1 : 0;
+    }
+
+    if (wav->length + SOUND_FRAME_SAMPLES > wav->capacity) {
+        size_t capacity = (wav->capacity > 0) ? 2 * wav->capacity : 64 * SOUND_FRAME_SAMPLES;
+        int16_t *grown = realloc(wav->samples, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            wav->failed = true;
+            return -1;
+        }
+        wav->samples = grown;
+        wav->capacity = capacity;
+    }
+    memcpy(&wav->samples[wav->length], pcm, sizeof(pcm));
+    wav->length += SOUND_FRAME_SAMPLES;
+    return 0;
+}
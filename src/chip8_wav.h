@@ -0,0 +1,33 @@
+#ifndef CHIP8_WAV_H
+#define CHIP8_WAV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_config.h"
+#include "chip8_sound.h"
+#include "chip8_state.h"
+
+// The sound of every emulated frame as 16-bit mono at SOUND_SAMPLE_RATE, the same for the same program on any machine
+// Goes to a WAV file, or stays in memory where the caller may read the samples and reset length as it goes
+struct chip8_wav {
+    struct chip8_tone tone;
+    FILE *out;
+    uint64_t data_bytes;
+
+    int16_t *samples;
+    size_t length;
+    size_t capacity;
+
+    // FNV-1a over the little-endian samples, what a WAV file would hold after its header
+    uint64_t hash;
+    bool failed;
+};
+
+int chip8_open_wav(struct chip8_wav *wav, const char *path, const struct chip8_config *config);
+int chip8_close_wav(struct chip8_wav *wav, const struct chip8_config *config);
+int chip8_write_wav_frame(struct chip8_wav *wav, const struct chip8_state *state);
+
+#endif // CHIP8_WAV_H
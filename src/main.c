@@ -1,70 +1,173 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "chip8.h"
 #include "chip8_audio.h"
 #include "chip8_config.h"
 #include "chip8_display.h"
 #include "chip8_exec.h"
+#include "chip8_record.h"
+#include "chip8_sdl_display.h"
 #include "chip8_state.h"
+#include "chip8_wav.h"
 
-int main(int argc, char **argv) {
-    if (argc != 2) {
-        fputs("Usage: chip8 <file>\n", stderr);
-        return EXIT_FAILURE;
-    }
+static void usage(void) {
+    fputs("Usage: chip8 [-t] [-s frames] [-p] [-w sine|square|triangle] [-l] [-H [-a audio.wav|-]] [-n frames] [-r video.y4m|video.ppm|-] <file>\n", stderr);
+}
 
+int main(int argc, char **argv) {
     struct chip8_state state;
     struct chip8_config config;
     struct chip8_display display;
     struct chip8_audio audio;
+    static struct chip8_recorder recorder;
+    static struct chip8_wav wav;
 
-    config.target_speed = 500;
+    config.target_speed = 15250;
     config.default_scale = 10;
+    config.turbo = false;
+    config.turbo_frame_skip = 0;
+    config.max_frames = 0;
+    config.phosphor = false;
+    config.waveform = WAVE_SINE;
+    config.low_latency_audio = false;
+
+    // Headless runs never touch SDL, there is no window and no sound
+    bool headless = false;
+    const char *record_path = NULL;
+    const char *wav_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "ts:pw:lHa:n:r:")) != -1) {
+        switch (opt) {
+            case 't':
+                config.turbo = true;
+                break;
+            case 's':
+                config.turbo_frame_skip = atoi(optarg);
+                break;
+            case 'p':
+                config.phosphor = true;
+                break;
+            case 'w':
+                if (strcmp(optarg, "sine") == 0) {
+                    config.waveform = WAVE_SINE;
+                } else if (strcmp(optarg, "square") == 0) {
+                    config.waveform = WAVE_SQUARE;
+                } else if (strcmp(optarg, "triangle") == 0) {
+                    config.waveform = WAVE_TRIANGLE;
+                } else {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                config.low_latency_audio = true;
+                break;
+            case 'H':
+                headless = true;
+                break;
+            case 'a':
+                wav_path = optarg;
+                break;
+            case 'n':
+                config.max_frames = atoi(optarg);
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    // Audio is only captured headless, with a window it goes to the sound card
+    if (optind != argc - 1 || config.turbo_frame_skip < 0 || config.max_frames < 0 || (wav_path != NULL && !headless)) {
+        usage();
+        return EXIT_FAILURE;
+    }
 
     if (chip8_init_state(&state, &config) == -1) {
         return EXIT_FAILURE;
     }
 
-    if (chip8_load_program(&state, &config, argv[1]) == -1) {
-        chip8_close_audio(&audio, &config);
-        chip8_close_display(&display, &config);
+    if (chip8_load_program(&state, &config, argv[optind]) == -1) {
         chip8_close_state(&state, &config);
         return EXIT_FAILURE;
     }
 
-    if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO) < 0) {
-        fprintf(stderr, "SDL_Init(): %s\n", SDL_GetError());
+    if (record_path != NULL && chip8_open_recorder(&recorder, record_path, &config) == -1) {
+        chip8_close_state(&state, &config);
         return EXIT_FAILURE;
     }
+    struct chip8_recorder *record = (record_path != NULL) ? &recorder : NULL;
 
-    if (chip8_init_display(&display, &config) == -1) {
+    if (headless) {
+        if (wav_path != NULL && chip8_open_wav(&wav, wav_path, &config) == -1) {
+            if (record != NULL) {
+                chip8_close_recorder(record, &config);
+            }
+            chip8_close_state(&state, &config);
+            return EXIT_FAILURE;
+        }
+        struct chip8_wav *capture = (wav_path != NULL) ? &wav : NULL;
+
+        chip8_init_headless_display(&display, &config);
+        int return_value = chip8_run(&state, &display, NULL, record, capture, &config);
+        chip8_close_display(&display, &config);
+        if (record != NULL && chip8_close_recorder(record, &config) == -1) {
+            return_value = -1;
+        }
+        if (capture != NULL && chip8_close_wav(capture, &config) == -1) {
+            return_value = -1;
+        }
+        chip8_close_state(&state, &config);
+        return (return_value == -1) ? EXIT_FAILURE : 0;
+    }
+
+    if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO) < 0) {
+        fprintf(stderr, "SDL_Init(): %s\n", SDL_GetError());
+        if (record != NULL) {
+            chip8_close_recorder(record, &config);
+        }
         chip8_close_state(&state, &config);
-        SDL_Quit();
         return EXIT_FAILURE;
     }
 
-    if (chip8_init_audio(&audio, &config) == -1) {
-        chip8_close_display(&display, &config);
+    if (chip8_init_sdl_display(&display, &config) == -1) {
+        if (record != NULL) {
+            chip8_close_recorder(record, &config);
+        }
         chip8_close_state(&state, &config);
         SDL_Quit();
         return EXIT_FAILURE;
     }
 
-    if (chip8_run(&state, &display, &audio, &config) == -1) {
-        chip8_close_audio(&audio, &config);
+    if (chip8_init_audio(&audio, &config) == -1) {
         chip8_close_display(&display, &config);
+        if (record != NULL) {
+            chip8_close_recorder(record, &config);
+        }
         chip8_close_state(&state, &config);
         SDL_Quit();
         return EXIT_FAILURE;
     }
 
+    int return_value = chip8_run(&state, &display, &audio, record, NULL, &config);
+
     chip8_close_audio(&audio, &config);
     chip8_close_display(&display, &config);
     SDL_Quit();
+    if (record != NULL && chip8_close_recorder(record, &config) == -1) {
+        return_value = -1;
+    }
     chip8_close_state(&state, &config);
-    
-    return 0;
+
+    return (return_value == -1) ? EXIT_FAILURE : 0;
 }
@@ -1,11 +1,23 @@
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "chip8_analysis.h"
+#include "chip8_aot.h"
 #include "chip8_config.h"
+#include "chip8_display.h"
 #include "chip8_exec.h"
+#include "chip8_frame.h"
+#include "chip8_multi.h"
+#include "chip8_record.h"
+#include "chip8_render.h"
+#include "chip8_sound.h"
 #include "chip8_state.h"
+#include "chip8_wav.h"
+#include "helper.h"
 #include "test.h"
 
 enum chip8_compare {
@@ -34,7 +46,10 @@ int chip8_compare_states(const struct chip8_state *s1, const struct chip8_state
 
     // Screen
     if (comp & COMP_SCREEN) {
-        if (memcmp(s1->screen, s2->screen, sizeof(s1->screen)) != 0) {
+        uint8_t screen1[SCREEN_BYTES], screen2[SCREEN_BYTES];
+        chip8_pack_screen(s1, screen1);
+        chip8_pack_screen(s2, screen2);
+        if (memcmp(screen1, screen2, sizeof(screen1)) != 0) {
             result |= COMP_SCREEN;
         }
     }
@@ -69,7 +84,8 @@ int chip8_compare_states(const struct chip8_state *s1, const struct chip8_state
 
     // Sound
     if (comp & COMP_SOUND) {
-        if (s1->sound_timer != s2->sound_timer) {
+        if (s1->sound_timer != s2->sound_timer || s1->pitch != s2->pitch || s1->has_pattern != s2->has_pattern
+            || memcmp(s1->audio_pattern, s2->audio_pattern, sizeof(s1->audio_pattern)) != 0) {
             result |= COMP_SOUND;
         }
     }
@@ -124,10 +140,13 @@ void chip8_diff_states(const struct chip8_state *s1, const struct chip8_state *s
 
     // Screen
     if (comp & COMP_SCREEN) {
+        uint8_t screen1[SCREEN_BYTES], screen2[SCREEN_BYTES];
+        chip8_pack_screen(s1, screen1);
+        chip8_pack_screen(s2, screen2);
         uint16_t screen_diffs = 0;
         int first_screen_diff = -1;
-        for (uint16_t i = 0; i < sizeof(s1->screen); i++) {
-            if (s1->screen[i] != s2->screen[i]) {
+        for (uint16_t i = 0; i < sizeof(screen1); i++) {
+            if (screen1[i] != screen2[i]) {
                 screen_diffs++;
                 if (first_screen_diff == -1) {
                     first_screen_diff = i;
@@ -139,7 +158,7 @@ void chip8_diff_states(const struct chip8_state *s1, const struct chip8_state *s
                 (unsigned) first_screen_diff, s1->memory[first_screen_diff], s2->memory[first_screen_diff]);
         } else if (screen_diffs > 0) {
             printf("Screen: %"PRIu16" diffs, first at %02"PRIx8": %02"PRIx8" != %02"PRIx8"\n",
-                screen_diffs, first_screen_diff, s1->screen[first_screen_diff], s2->memory[first_screen_diff]);
+                screen_diffs, first_screen_diff, screen1[first_screen_diff], s2->memory[first_screen_diff]);
         } else {
             puts("Screen: match");
         }
@@ -208,6 +227,9 @@ void chip8_diff_states(const struct chip8_state *s1, const struct chip8_state *s
     if (comp & COMP_SOUND) {
         if (s1->sound_timer != s2->sound_timer) {
             printf(" Sound: %02"PRIx8" != %02"PRIx8"\n", s1->sound_timer, s2->sound_timer);
+        } else if (s1->pitch != s2->pitch || s1->has_pattern != s2->has_pattern
+                   || memcmp(s1->audio_pattern, s2->audio_pattern, sizeof(s1->audio_pattern)) != 0) {
+            printf(" Sound: pattern or pitch %02"PRIx8" != %02"PRIx8"\n", s1->pitch, s2->pitch);
         } else {
             puts(" Sound: match");
         }
@@ -295,6 +317,27 @@ void chip8_diff_states(const struct chip8_state *s1, const struct chip8_state *s
     }
 }
 
+// Load a packed screen, anything past length is blank
+void set_screen(struct chip8_state *state, const uint8_t *screen, size_t length) {
+    uint8_t packed[SCREEN_BYTES] = {0};
+    memcpy(packed, screen, length);
+    chip8_unpack_screen(state, packed);
+}
+
+void set_screen_byte(struct chip8_state *state, uint16_t index, uint8_t value) {
+    uint8_t packed[SCREEN_BYTES];
+    chip8_pack_screen(state, packed);
+    packed[index] = value;
+    chip8_unpack_screen(state, packed);
+}
+
+void expect_eq_screen(const struct chip8_state *s1, const struct chip8_state *s2) {
+    uint8_t screen1[SCREEN_BYTES], screen2[SCREEN_BYTES];
+    chip8_pack_screen(s1, screen1);
+    chip8_pack_screen(s2, screen2);
+    expect_eq_mem(screen1, screen2, sizeof(screen1));
+}
+
 void test_scroll(void) {
     struct chip8_state initial, expected;
 
@@ -358,10 +401,10 @@ void test_scroll(void) {
     // 00B0 - Nonempty screen, up by 0
     chip8_reset_state(&initial, NULL);
     chip8_reset_state(&expected, NULL);
-    memcpy(&initial.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&initial, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xB0}, 2);
     chip8_advance_state(&initial, NULL);
-    memcpy(&expected.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&expected, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xB0}, 2);
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -369,10 +412,10 @@ void test_scroll(void) {
     // 00C0 - Nonempty screen, down by 0
     chip8_reset_state(&initial, NULL);
     chip8_reset_state(&expected, NULL);
-    memcpy(&initial.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&initial, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xC0}, 2);
     chip8_advance_state(&initial, NULL);
-    memcpy(&expected.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&expected, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xC0}, 2);
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -380,10 +423,10 @@ void test_scroll(void) {
     // 00B1 - Nonempty screen, up by 1
     chip8_reset_state(&initial, NULL);
     chip8_reset_state(&expected, NULL);
-    memcpy(&initial.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&initial, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xB1}, 2);
     chip8_advance_state(&initial, NULL);
-    memcpy(&expected.screen, (const uint8_t []){[992] = 0xFF, [1007] = 0xFF}, 1008);
+    set_screen(&expected, (const uint8_t []){[992] = 0xFF, [1007] = 0xFF}, 1008);
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xB1}, 2);
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -391,10 +434,10 @@ void test_scroll(void) {
     // 00C1 - Nonempty screen, down by 1
     chip8_reset_state(&initial, NULL);
     chip8_reset_state(&expected, NULL);
-    memcpy(&initial.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&initial, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xC1}, 2);
     chip8_advance_state(&initial, NULL);
-    memcpy(&expected.screen, (const uint8_t []){[16] = 0xFF, [31] = 0xFF}, 32);
+    set_screen(&expected, (const uint8_t []){[16] = 0xFF, [31] = 0xFF}, 32);
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xC1}, 2);
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -402,10 +445,10 @@ void test_scroll(void) {
     // 00FB - Nonempty screen, right by 4
     chip8_reset_state(&initial, NULL);
     chip8_reset_state(&expected, NULL);
-    memcpy(&initial.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&initial, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xFB}, 2);
     chip8_advance_state(&initial, NULL);
-    memcpy(&expected.screen, (const uint8_t []){[0] = 0x0F, [1] = 0xF0, [15] = 0x0F, [1008] = 0x0F, [1009] = 0xF0, [1023] = 0x0F}, sizeof(expected.screen));
+    set_screen(&expected, (const uint8_t []){[0] = 0x0F, [1] = 0xF0, [15] = 0x0F, [1008] = 0x0F, [1009] = 0xF0, [1023] = 0x0F}, SCREEN_BYTES);
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xFB}, 2);
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -413,14 +456,26 @@ void test_scroll(void) {
     // 00FC - Nonempty screen, left by 4
     chip8_reset_state(&initial, NULL);
     chip8_reset_state(&expected, NULL);
-    memcpy(&initial.screen, nonempty_screen, sizeof(nonempty_screen));
+    set_screen(&initial, nonempty_screen, sizeof(nonempty_screen));
     memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xFC}, 2);
     chip8_advance_state(&initial, NULL);
-    memcpy(&expected.screen, (const uint8_t []){[0] = 0xF0, [14] = 0x0F, [15] = 0xF0, [1008] = 0xF0, [1022] = 0x0F, [1023] = 0xF0}, sizeof(expected.screen));
+    set_screen(&expected, (const uint8_t []){[0] = 0xF0, [14] = 0x0F, [15] = 0xF0, [1008] = 0xF0, [1022] = 0x0F, [1023] = 0xF0}, SCREEN_BYTES);
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xFC}, 2);
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
 
+    // 00CA x5, 00BF x3 - down by 50 then up by 45, wrapping the row origin around more than once
+    const uint8_t scrolls[] = {0x00, 0xCA, 0x00, 0xCA, 0x00, 0xCA, 0x00, 0xCA, 0x00, 0xCA, 0x00, 0xBF, 0x00, 0xBF, 0x00, 0xBF};
+    chip8_reset_state(&initial, NULL);
+    chip8_reset_state(&expected, NULL);
+    set_screen(&initial, (const uint8_t []){[160] = 0xFF, [655] = 0xFF}, 656);
+    memcpy(&initial.memory[initial.pc], scrolls, sizeof(scrolls));
+    chip8_advance_state_batch(&initial, NULL, 8);
+    set_screen(&expected, (const uint8_t []){[240] = 0xFF}, 241);
+    memcpy(&expected.memory[expected.pc], scrolls, sizeof(scrolls));
+    expected.pc += sizeof(scrolls);
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
     chip8_close_state(&initial, NULL);
     chip8_close_state(&expected, NULL);
 }
@@ -462,10 +517,10 @@ void test_draw(void) {
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0xD0, 0x01}, 2);
     expected.index_register = expected.pc + 2;
     expected.memory[expected.index_register] = 0xFF;
-    expected.screen[0] = 0xFF;
-    expected.screen[1] = 0xFF;
-    expected.screen[16] = 0xFF;
-    expected.screen[17] = 0xFF;
+    set_screen_byte(&expected, 0, 0xFF);
+    set_screen_byte(&expected, 1, 0xFF);
+    set_screen_byte(&expected, 16, 0xFF);
+    set_screen_byte(&expected, 17, 0xFF);
     expected.registers[0xF] = 0;
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -486,12 +541,12 @@ void test_draw(void) {
     expected.index_register = expected.pc + 2;
     expected.memory[expected.index_register] = 0xFF;
     expected.memory[expected.index_register + 1] = 0x0F;
-    expected.screen[33] = 0xFF;
-    expected.screen[34] = 0xFF;
-    expected.screen[49] = 0xFF;
-    expected.screen[50] = 0xFF;
-    expected.screen[66] = 0xFF;
-    expected.screen[82] = 0xFF;
+    set_screen_byte(&expected, 33, 0xFF);
+    set_screen_byte(&expected, 34, 0xFF);
+    set_screen_byte(&expected, 49, 0xFF);
+    set_screen_byte(&expected, 50, 0xFF);
+    set_screen_byte(&expected, 66, 0xFF);
+    set_screen_byte(&expected, 82, 0xFF);
     expected.registers[0xF] = 0;
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -508,7 +563,7 @@ void test_draw(void) {
     expected.hires = true;
     expected.index_register = expected.pc + 2;
     expected.memory[expected.index_register] = 0xFF;
-    expected.screen[0] = 0xFF;
+    set_screen_byte(&expected, 0, 0xFF);
     expected.registers[0xF] = 0;
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
@@ -536,13 +591,13 @@ void test_draw(void) {
         0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F, 0xFF, 0x0F
     }, 32);
     for (int i = 0; i < 16; i++) {
-        expected.screen[16 * (i + 1)] = 0x0F;
-        expected.screen[16 * (i + 1) + 1] = 0xF0;
-        expected.screen[16 * (i + 1) + 2] = 0xF0;
+        set_screen_byte(&expected, 16 * (i + 1), 0x0F);
+        set_screen_byte(&expected, 16 * (i + 1) + 1, 0xF0);
+        set_screen_byte(&expected, 16 * (i + 1) + 2, 0xF0);
     }
     expected.registers[0xF] = 0;
     expected.pc += 2;
-    expect_eq_mem(initial.screen, expected.screen, sizeof(initial.screen));
+    expect_eq_screen(&initial, &expected);
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
 
     // D012 - draw nonempty 8x2 sprite in hires at (124, 63) on nonempty screen
@@ -555,10 +610,10 @@ void test_draw(void) {
     initial.index_register = initial.pc + 2;
     initial.memory[initial.index_register] = 0xFF;
     initial.memory[initial.index_register + 1] = 0xFF;
-    initial.screen[0] = 0xFF;
-    initial.screen[15] = 0xFF;
-    initial.screen[1008] = 0xFF;
-    initial.screen[1023] = 0xFF;
+    set_screen_byte(&initial, 0, 0xFF);
+    set_screen_byte(&initial, 15, 0xFF);
+    set_screen_byte(&initial, 1008, 0xFF);
+    set_screen_byte(&initial, 1023, 0xFF);
     chip8_advance_state(&initial, NULL);
     memcpy(&expected.memory[expected.pc], (const uint8_t []){0xD0, 0x12}, 2);
     expected.hires = true;
@@ -567,15 +622,454 @@ void test_draw(void) {
     expected.index_register = expected.pc + 2;
     expected.memory[expected.index_register] = 0xFF;
     expected.memory[expected.index_register + 1] = 0xFF;
-    expected.screen[0] = 0xFF;
-    expected.screen[15] = 0xFF;
-    expected.screen[1008] = 0xFF;
-    expected.screen[1023] = 0xF0;
+    set_screen_byte(&expected, 0, 0xFF);
+    set_screen_byte(&expected, 15, 0xFF);
+    set_screen_byte(&expected, 1008, 0xFF);
+    set_screen_byte(&expected, 1023, 0xF0);
     expected.registers[0xF] = 1;
     expected.pc += 2;
-    expect_eq_mem(initial.screen, expected.screen, sizeof(initial.screen));
+    expect_eq_screen(&initial, &expected);
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // D011 - draw nonempty 8x1 sprite in lores at (62, 0), clipped at the right edge
+    chip8_reset_state(&initial, NULL);
+    chip8_reset_state(&expected, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0xD0, 0x11}, 2);
+    initial.registers[0x0] = 62;
+    initial.index_register = initial.pc + 2;
+    initial.memory[initial.index_register] = 0xFF;
+    chip8_advance_state(&initial, NULL);
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0xD0, 0x11}, 2);
+    expected.registers[0x0] = 62;
+    expected.index_register = expected.pc + 2;
+    expected.memory[expected.index_register] = 0xFF;
+    set_screen_byte(&expected, 15, 0x0F);
+    set_screen_byte(&expected, 31, 0x0F);
+    expected.registers[0xF] = 0;
+    expected.pc += 2;
+    expect_eq_screen(&initial, &expected);
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    chip8_close_state(&initial, NULL);
+    chip8_close_state(&expected, NULL);
+}
+
+void test_lores(void) {
+    struct chip8_state initial, expected;
+
+    chip8_init_state(&initial, NULL);
+    chip8_init_state(&expected, NULL);
+
+    // D015 - lores draws go to the native plane and show up doubled
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0xD0, 0x15}, 2);
+    initial.registers[0x0] = 1;
+    chip8_advance_state(&initial, NULL);
+    expect_true(initial.lores_native);
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0xD0, 0x15}, 2);
+    expected.registers[0x0] = 1;
+    for (uint8_t y = 0; y < 5; y++) {
+        uint8_t glyph = expected.memory[FONT_MEMORY_OFFSET + y];
+        // 16 doubled pixels starting at hires x = 2, spread over three bytes
+        uint32_t doubled = 0;
+        for (int bit = 7; bit >= 0; bit--) {
+            doubled = (doubled << 2) | ((glyph >> bit) & 1) * 3;
+        }
+        doubled <<= 6;
+        for (uint8_t k = 0; k < 2; k++) {
+            for (uint8_t i = 0; i < 3; i++) {
+                set_screen_byte(&expected, (2 * y + k) * DISPLAY_WIDTH / 8 + i, (doubled >> (16 - 8 * i)) & 0xFF);
+            }
+        }
+    }
+    expected.pc += 2;
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // 00FF 00FE - the plane is expanded for hires and compacted again on the way back
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xFF, 0x00, 0xFE}, 4);
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xFF, 0x00, 0xFE}, 4);
+    chip8_advance_state(&initial, NULL);
+    expect_false(initial.lores_native);
+    chip8_advance_state(&initial, NULL);
+    expect_true(initial.lores_native);
+    expected.pc += 4;
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // 00C2 00C1 - an odd scroll splits the lores pixels, so the picture moves to the hires rows
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xC2, 0x00, 0xC1}, 4);
+    chip8_advance_state(&initial, NULL);
+    expect_true(initial.lores_native);
+    chip8_advance_state(&initial, NULL);
+    expect_false(initial.lores_native);
+    uint8_t screen[SCREEN_BYTES] = {0};
+    uint8_t shifted[SCREEN_BYTES];
+    chip8_pack_screen(&expected, screen);
+    memset(shifted, 0, 3 * DISPLAY_WIDTH / 8);
+    memcpy(&shifted[3 * DISPLAY_WIDTH / 8], screen, SCREEN_BYTES - 3 * DISPLAY_WIDTH / 8);
+    set_screen(&expected, shifted, sizeof(shifted));
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0x00, 0xC2, 0x00, 0xC1}, 4);
+    expected.pc += 4;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
 
+    // 00E0 - clearing in lores goes back to the native plane
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x00, 0xE0}, 2);
+    chip8_advance_state(&initial, NULL);
+    expect_true(initial.lores_native);
+
+    chip8_close_state(&initial, NULL);
+    chip8_close_state(&expected, NULL);
+}
+
+void test_planes(void) {
+    struct chip8_state state;
+    uint8_t plane0[SCREEN_BYTES], plane1[SCREEN_BYTES];
+
+    chip8_init_state(&state, NULL);
+    state.hires = true;
+
+    // F301 D012 - with both planes selected, plane 1 takes the two bytes after plane 0's
+    const uint8_t program[] = {0xF3, 0x01, 0xD0, 0x12, 0x81, 0x42, 0x18, 0x24};
+    memcpy(&state.memory[state.pc], program, sizeof(program));
+    state.index_register = state.pc + 4;
+    chip8_advance_state_batch(&state, NULL, 2);
+    expect_eq(state.planes, 3);
+    expect_true(state.multi_plane);
+    expect_eq(state.registers[0xF], 0);
+    chip8_pack_plane(&state, 0, plane0);
+    chip8_pack_plane(&state, 1, plane1);
+    expect_eq(plane0[0], 0x81);
+    expect_eq(plane0[DISPLAY_WIDTH / 8], 0x42);
+    expect_eq(plane1[0], 0x18);
+    expect_eq(plane1[DISPLAY_WIDTH / 8], 0x24);
+
+    // F201 00C1 D021 00E0 - only plane 1 scrolls, collides and is cleared
+    memcpy(&state.memory[state.pc], (const uint8_t []){0xF2, 0x01, 0x00, 0xC1, 0xD0, 0x21, 0x00, 0xE0}, 8);
+    state.registers[0x2] = 1;
+    state.index_register = 0x300;
+    state.memory[0x300] = 0x18;
+    chip8_advance_state_batch(&state, NULL, 3);
+    expect_eq(state.registers[0xF], 1);
+    chip8_pack_plane(&state, 0, plane0);
+    chip8_pack_plane(&state, 1, plane1);
+    expect_eq(plane0[0], 0x81);
+    expect_eq(plane0[DISPLAY_WIDTH / 8], 0x42);
+    expect_eq(plane1[0], 0x00);
+    expect_eq(plane1[DISPLAY_WIDTH / 8], 0x00);
+    expect_eq(plane1[2 * DISPLAY_WIDTH / 8], 0x24);
+    chip8_advance_state(&state, NULL);
+    chip8_pack_plane(&state, 0, plane0);
+    chip8_pack_plane(&state, 1, plane1);
+    expect_eq(plane0[0], 0x81);
+    expect_eq(plane1[2 * DISPLAY_WIDTH / 8], 0x00);
+
+    // Both compositing paths give each pixel the palette entry of its plane bits
+    const uint8_t planes[] = {0xF3, 0x01, 0xD0, 0x12, 0xF0, 0xCC, 0x0F, 0xAA};
+    chip8_reset_state(&state, NULL);
+    state.hires = true;
+    memcpy(&state.memory[state.pc], planes, sizeof(planes));
+    state.index_register = state.pc + 4;
+    chip8_advance_state_batch(&state, NULL, 2);
+
+    static struct chip8_frame frame;
+    chip8_capture_frame(&frame, &state, 0);
+    static uint32_t scalar[DISPLAY_HEIGHT][DISPLAY_WIDTH], vector[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    chip8_render_rows(&frame, &scalar[0][0], sizeof(scalar[0]), 0, DISPLAY_HEIGHT - 1, false);
+    expect_eq(scalar[0][0], chip8_palette[1]);
+    expect_eq(scalar[0][4], chip8_palette[2]);
+    expect_eq(scalar[1][0], chip8_palette[3]);
+    expect_eq(scalar[1][1], chip8_palette[1]);
+    expect_eq(scalar[1][3], chip8_palette[0]);
+    expect_eq(scalar[1][6], chip8_palette[2]);
+    expect_eq(scalar[2][0], chip8_palette[0]);
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        chip8_render_rows(&frame, &vector[0][0], sizeof(vector[0]), 0, DISPLAY_HEIGHT - 1, true);
+        expect_eq_mem(scalar, vector, sizeof(scalar));
+    }
+#endif
+
+    chip8_close_state(&state, NULL);
+}
+
+void test_phosphor(void) {
+    static struct chip8_phosphor sse, avx2;
+    static uint32_t pixels[DISPLAY_HEIGHT][DISPLAY_WIDTH], avx2_pixels[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+
+    // A lit pixel shows at full brightness at once
+    chip8_init_phosphor(&sse);
+    sse.target[3][5] = chip8_palette[1];
+    chip8_blend_phosphor(&sse, &pixels[0][0], sizeof(pixels[0]), 0, DISPLAY_HEIGHT - 1, false);
+    expect_eq(pixels[3][5], chip8_palette[1]);
+    expect_eq(pixels[3][6], chip8_palette[0]);
+    expect_eq(sse.fading_rows, 0);
+
+    // Once erased it dims a little every frame until it is background again
+    sse.target[3][5] = chip8_palette[0];
+    chip8_blend_phosphor(&sse, &pixels[0][0], sizeof(pixels[0]), 0, DISPLAY_HEIGHT - 1, false);
+    expect_eq(sse.fading_rows, UINT64_C(1) << 3);
+    expect_eq(pixels[3][5] & 0xFF, (chip8_palette[1] & 0xFF) * PHOSPHOR_DECAY / 256);
+    expect_eq(pixels[3][5] >> 24, 0xFF);
+    expect_eq(pixels[4][5], chip8_palette[0]);
+
+    uint32_t previous = pixels[3][5];
+    chip8_blend_phosphor(&sse, &pixels[3][0], sizeof(pixels[0]), 3, 3, false);
+    expect_lt(pixels[3][5] & 0xFF, previous & 0xFF);
+    for (uint8_t i = 0; i < 8; i++) {
+        chip8_blend_phosphor(&sse, &pixels[3][0], sizeof(pixels[0]), 3, 3, false);
+    }
+    expect_eq(pixels[3][5], chip8_palette[0]);
+    expect_eq(sse.fading_rows, 0);
+
+    // Both paths fade every palette colour the same way
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        chip8_init_phosphor(&avx2);
+        avx2.shown[3][5] = chip8_palette[1];
+        for (uint16_t x = 0; x < DISPLAY_WIDTH; x++) {
+            avx2.shown[10][x] = chip8_palette[x % 4];
+            avx2.target[10][x] = chip8_palette[(x / 4) % 4];
+        }
+        sse = avx2;
+        for (uint8_t i = 0; i < 3; i++) {
+            chip8_blend_phosphor(&sse, &pixels[0][0], sizeof(pixels[0]), 0, DISPLAY_HEIGHT - 1, false);
+            chip8_blend_phosphor(&avx2, &avx2_pixels[0][0], sizeof(avx2_pixels[0]), 0, DISPLAY_HEIGHT - 1, true);
+            expect_eq_mem(pixels, avx2_pixels, sizeof(pixels));
+            expect_eq(sse.fading_rows, avx2.fading_rows);
+        }
+    }
+#endif
+}
+
+void test_tone(void) {
+    static struct chip8_tone tone, vector;
+    static float samples[1000], vector_samples[1000];
+
+    // 500 Hz at 44100 Hz follows a sine to within the table's resolution
+    chip8_init_tone(&tone, WAVE_SINE, 500.0, 44100, 0.5f);
+    tone.use_avx2 = false;
+    chip8_fill_tone(&tone, samples, 1000);
+    for (int i = 0; i < 1000; i += 37) {
+        expect_between(samples[i], 0.5 * sin(2 * M_PI * 500.0 * i / 44100) - 0.01, 0.5 * sin(2 * M_PI * 500.0 * i / 44100) + 0.01);
+    }
+    expect_eq(tone.phase, (uint32_t) (1000 * tone.step));
+
+    // The phase wraps cleanly instead of overflowing, one sample on from the end of a cycle is its start
+    tone.phase = UINT32_MAX - tone.step + 1;
+    chip8_fill_tone(&tone, samples, 2);
+    expect_eq(samples[1], tone.table[0]);
+    expect_eq(tone.phase, tone.step);
+
+    // Square and triangle reach the volume at their peaks and only there
+    chip8_init_tone(&tone, WAVE_SQUARE, 500.0, 44100, 0.5f);
+    expect_eq(tone.table[0], 0.5f);
+    expect_eq(tone.table[WAVETABLE_LENGTH - 1], -0.5f);
+    chip8_init_tone(&tone, WAVE_TRIANGLE, 500.0, 44100, 0.5f);
+    expect_eq(tone.table[0], 0.0f);
+    expect_eq(tone.table[WAVETABLE_LENGTH / 4], 0.5f);
+    expect_eq(tone.table[3 * WAVETABLE_LENGTH / 4], -0.5f);
+
+    // Both paths give the same samples and end on the same phase, including an odd tail
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2")) {
+        chip8_init_tone(&tone, WAVE_SINE, 440.0, 48000, 0.8f);
+        tone.phase = UINT32_MAX - 3 * tone.step;
+        vector = tone;
+        tone.use_avx2 = false;
+        vector.use_avx2 = true;
+        chip8_fill_tone(&tone, samples, 997);
+        chip8_fill_tone(&vector, vector_samples, 997);
+        expect_eq_mem(samples, vector_samples, sizeof(float) * 997);
+        expect_eq(tone.phase, vector.phase);
+    }
+#endif
+}
+
+void test_sound_ring(void) {
+    static struct chip8_sound_ring ring;
+    static struct chip8_tone tone;
+    static struct chip8_state state;
+    static float in[SOUND_FRAME_SAMPLES], out[SOUND_RING_LENGTH];
+
+    for (size_t i = 0; i < SOUND_FRAME_SAMPLES; i++) {
+        in[i] = (float) i;
+    }
+
+    // Two frames fit, a third would overrun the reader and is dropped whole
+    chip8_init_sound_ring(&ring);
+    expect_true(chip8_write_sound(&ring, in, SOUND_FRAME_SAMPLES));
+    expect_true(chip8_write_sound(&ring, in, SOUND_FRAME_SAMPLES));
+    expect_false(chip8_write_sound(&ring, in, SOUND_FRAME_SAMPLES));
+    expect_eq(ring.dropped, 1);
+
+    // Reads come out in order across frames and across the end of the ring
+    expect_eq(chip8_read_sound(&ring, out, 1000), 1000);
+    expect_eq(out[0], 0.0f);
+    expect_eq(out[SOUND_FRAME_SAMPLES], 0.0f);
+    expect_eq(out[999], (float) (999 - SOUND_FRAME_SAMPLES));
+    expect_true(chip8_write_sound(&ring, in, SOUND_FRAME_SAMPLES));
+    expect_eq(chip8_read_sound(&ring, out, SOUND_RING_LENGTH), 3 * SOUND_FRAME_SAMPLES - 1000);
+    expect_eq(out[0], (float) (1000 - SOUND_FRAME_SAMPLES));
+    expect_eq(out[2 * SOUND_FRAME_SAMPLES - 1000], 0.0f);
+    expect_eq(out[3 * SOUND_FRAME_SAMPLES - 1001], (float) (SOUND_FRAME_SAMPLES - 1));
+    expect_eq(ring.underruns, 1);
+
+    // Once empty the reader gets silence
+    out[0] = 1.0f;
+    expect_eq(chip8_read_sound(&ring, out, 16), 0);
+    expect_eq(out[0], 0.0f);
+    expect_eq(ring.underruns, 2);
+
+    // The tone only sounds while the sound timer runs, and picks up where it left off
+    chip8_init_state(&state, NULL);
+    chip8_init_tone(&tone, WAVE_SQUARE, 500.0, SOUND_SAMPLE_RATE, 0.5f);
+    chip8_generate_sound(&tone, &state, out, SOUND_FRAME_SAMPLES);
+    expect_eq(out[0], 0.0f);
+    expect_eq(tone.phase, 0);
+    state.sound_timer = 2;
+    chip8_generate_sound(&tone, &state, out, SOUND_FRAME_SAMPLES);
+    expect_eq(out[0], 0.5f);
+    expect_eq(tone.phase, (uint32_t) (SOUND_FRAME_SAMPLES * tone.step));
+
+    // 6105 6000 F118 6000 6000 6000 F018 120E - a beep from the 3rd to the 7th of 10 instructions
+    // It sounds for that part of the frame only, even though the timer is back to 0 once the frame ends
+    const struct chip8_config config = {.target_speed = 600};
+    chip8_reset_state(&state, NULL);
+    memcpy(&state.memory[state.pc], (const uint8_t []){0x61, 0x05, 0x60, 0x00, 0xF1, 0x18, 0x60, 0x00, 0x60, 0x00, 0x60, 0x00, 0xF0, 0x18, 0x12, 0x0E}, 16);
+    chip8_init_tone(&tone, WAVE_SQUARE, 500.0, SOUND_SAMPLE_RATE, 0.5f);
+    chip8_advance_frame(&state, &config, 0);
+    expect_eq(state.sound_timer, 0);
+    expect_eq(state.num_sound_edges, 3);
+    chip8_generate_sound(&tone, &state, out, SOUND_FRAME_SAMPLES);
+    expect_eq(out[2 * SOUND_FRAME_SAMPLES / 10 - 1], 0.0f);
+    expect_eq(out[2 * SOUND_FRAME_SAMPLES / 10], 0.5f);
+    expect_true(out[6 * SOUND_FRAME_SAMPLES / 10 - 1] != 0.0f);
+    expect_eq(out[6 * SOUND_FRAME_SAMPLES / 10], 0.0f);
+    expect_eq(out[SOUND_FRAME_SAMPLES - 1], 0.0f);
+    expect_eq(tone.phase, (uint32_t) ((6 * SOUND_FRAME_SAMPLES / 10 - 2 * SOUND_FRAME_SAMPLES / 10) * tone.step));
+    chip8_close_state(&state, NULL);
+}
+
+void test_rate_control(void) {
+    static struct chip8_sound_ring ring;
+    static struct chip8_rate_control rate;
+    static float samples[SOUND_MAX_FRAME_SAMPLES];
+
+    // The device starts out on silence instead of an underrun
+    chip8_init_sound_ring(&ring);
+    chip8_init_rate_control(&rate, &ring);
+    expect_eq(atomic_load(&ring.written), SOUND_MIN_DEPTH);
+
+    // A device clock 0.3% fast taking whole buffers, the frames stretch to keep up and the ring settles on its target
+    size_t shortest = SIZE_MAX, longest = 0;
+    double consumed = 0.0;
+    for (int frame = 0; frame < 3000; frame++) {
+        size_t count = chip8_pace_sound(&rate, &ring);
+        shortest = (count < shortest) ? count : shortest;
+        longest = (count > longest) ? count : longest;
+        chip8_write_sound(&ring, samples, count);
+        for (consumed += SOUND_FRAME_SAMPLES * 1.003; consumed >= SOUND_LOW_LATENCY_SAMPLES; consumed -= SOUND_LOW_LATENCY_SAMPLES) {
+            chip8_read_sound(&ring, samples, SOUND_LOW_LATENCY_SAMPLES);
+        }
+    }
+    expect_eq(atomic_load(&ring.underruns), 0);
+    expect_eq(ring.dropped, 0);
+    expect_between(shortest, SOUND_FRAME_SAMPLES - 4, SOUND_FRAME_SAMPLES);
+    expect_between(longest, SOUND_FRAME_SAMPLES, SOUND_MAX_FRAME_SAMPLES);
+    expect_between(rate.ratio, 1.002, 1.004);
+    expect_eq(rate.target, SOUND_MIN_DEPTH);
+    expect_between(rate.depth, SOUND_MIN_DEPTH - 32.0, SOUND_MIN_DEPTH + 32.0);
+
+    // An underrun raises the target and refills the ring
+    chip8_init_sound_ring(&ring);
+    chip8_init_rate_control(&rate, &ring);
+    chip8_pace_sound(&rate, &ring);
+    chip8_read_sound(&ring, samples, SOUND_LOW_LATENCY_SAMPLES);
+    chip8_read_sound(&ring, samples, SOUND_LOW_LATENCY_SAMPLES);
+    chip8_pace_sound(&rate, &ring);
+    expect_eq(rate.target, SOUND_MIN_DEPTH + 128);
+    expect_eq(atomic_load(&ring.written) - atomic_load(&ring.read), rate.target);
+
+    // A long absence does not, and a target that holds is lowered again after a while
+    for (uint8_t i = 0; i < 20; i++) {
+        chip8_read_sound(&ring, samples, SOUND_LOW_LATENCY_SAMPLES);
+    }
+    chip8_pace_sound(&rate, &ring);
+    expect_eq(rate.target, SOUND_MIN_DEPTH + 128);
+    for (int frame = 0; frame < 300; frame++) {
+        chip8_pace_sound(&rate, &ring);
+    }
+    expect_eq(rate.target, SOUND_MIN_DEPTH + 96);
+}
+
+void test_audio_pattern(void) {
+    static struct chip8_tone tone;
+    static float samples[SOUND_FRAME_SAMPLES];
+    struct chip8_state initial, expected;
+
+    // Until a pattern is loaded the beeper plays at the default pitch
+    chip8_init_state(&initial, NULL);
+    expect_eq(initial.pitch, 64);
+    expect_false(initial.has_pattern);
+
+    // A300 F002 - load the pattern from 0x300
+    chip8_init_state(&expected, NULL);
+    const uint8_t pattern[16] = {0xF0, 0x0F, 0xAA, 0x55, 0x01, 0x80, 0xFF, 0x00, 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xFF};
+    memcpy(&initial.memory[0x300], pattern, sizeof(pattern));
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0xA3, 0x00, 0xF0, 0x02}, 4);
+    chip8_advance_state_batch(&initial, NULL, 2);
+    expect_eq_mem(initial.audio_pattern, pattern, sizeof(pattern));
+    expect_true(initial.has_pattern);
+    expect_eq(initial.pc, PROGRAM_MEMORY_OFFSET + 4);
+
+    // 6520 F53A - set the pitch from V5
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x65, 0x20, 0xF5, 0x3A}, 4);
+    chip8_advance_state_batch(&initial, NULL, 2);
+    expect_eq(initial.pitch, 0x20);
+
+    // Only F002 exists, not FX02 for other x
+    struct chip8_instruction inst;
+    chip8_decode(&inst, 0xF102);
+    expect_eq(inst.op, CHIP8_OP_UNKNOWN);
+    chip8_decode(&inst, 0xF002);
+    expect_eq(inst.op, CHIP8_OP_F002);
+
+    // At pitch 64 the pattern plays at 4000 bits a second, about 11 samples a bit at 44100 Hz
+    initial.pitch = 64;
+    chip8_init_tone(&tone, WAVE_SINE, 500.0, SOUND_SAMPLE_RATE, 0.5f);
+    chip8_generate_sound(&tone, &initial, samples, SOUND_FRAME_SAMPLES);
+    expect_eq(samples[0], 0.0f);
+    initial.sound_timer = 1;
+    chip8_generate_sound(&tone, &initial, samples, SOUND_FRAME_SAMPLES);
+    expect_eq(samples[0], 0.5f);
+    expect_eq(samples[40], 0.5f);
+    expect_eq(samples[50], -0.5f);
+    expect_eq(samples[SOUND_FRAME_SAMPLES - 1], -0.5f);
+    expect_eq(tone.phase, 0);
+    expect_eq(tone.pattern_phase, (uint32_t) (SOUND_FRAME_SAMPLES * tone.pattern_steps[64]));
+    expect_between(tone.pattern_steps[64 + 48], 2 * tone.pattern_steps[64] - 1, 2 * tone.pattern_steps[64] + 1);
+
+    // A new pattern is picked up on the next frame
+    initial.audio_pattern[0] = 0x00;
+    chip8_generate_sound(&tone, &initial, samples, 1);
+    expect_eq(tone.pattern_table[0], -0.5f);
+
+    // The pattern and pitch are saved with the state
+    FILE *f = tmpfile();
+    if (f != NULL) {
+        expect_eq(chip8_dump_state(f, &initial, NULL), 0);
+        rewind(f);
+        expect_eq(chip8_load_state(f, &expected, NULL), 0);
+        expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+        // A state written in another format is refused before anything is loaded
+        rewind(f);
+        expect_eq(serialize_16(f, 0xFFFF), 0);
+        rewind(f);
+        expected.pitch = 0;
+        expect_eq(chip8_load_state(f, &expected, NULL), -1);
+        expect_eq(expected.pitch, 0);
+        fclose(f);
+    }
+
     chip8_close_state(&initial, NULL);
     chip8_close_state(&expected, NULL);
 }
@@ -1236,7 +1730,7 @@ void test_reg_ops(void) {
     expected.pc += 2;
     expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
 
-    // CA40 - set VA = 0x40 & rand()
+    // CA40 - set VA = 0x40 & random number
     for (int i = 0; i < 10; i++) {
         chip8_reset_state(&initial, NULL);
         chip8_reset_state(&expected, NULL);
@@ -1543,11 +2037,673 @@ void test_reg_ldst(void) {
     chip8_close_state(&expected, NULL);
 }
 
+void test_random(void) {
+    struct chip8_state initial, expected;
+
+    chip8_init_state(&initial, NULL);
+    chip8_init_state(&expected, NULL);
+
+    // CX FF - the same seed gives the same numbers, a different seed does not
+    const uint8_t program[] = {0xC0, 0xFF, 0xC1, 0xFF, 0xC2, 0xFF, 0xC3, 0xFF, 0xC4, 0xFF, 0xC5, 0xFF, 0xC6, 0xFF, 0xC7, 0xFF};
+    chip8_seed_state(&initial, 1234);
+    chip8_seed_state(&expected, 1234);
+    chip8_reset_state(&initial, NULL);
+    chip8_reset_state(&expected, NULL);
+    memcpy(&initial.memory[initial.pc], program, sizeof(program));
+    memcpy(&expected.memory[expected.pc], program, sizeof(program));
+    chip8_advance_state_batch(&initial, NULL, 8);
+    chip8_advance_state_batch(&expected, NULL, 8);
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // Resetting keeps the seed and replays the sequence
+    uint8_t first[16];
+    memcpy(first, initial.registers, sizeof(first));
+    chip8_reset_state(&initial, NULL);
+    memcpy(&initial.memory[initial.pc], program, sizeof(program));
+    chip8_advance_state_batch(&initial, NULL, 8);
+    expect_eq(initial.rng_seed, 1234);
+    expect_eq(memcmp(initial.registers, first, sizeof(first)), 0);
+
+    chip8_seed_state(&expected, 4321);
+    chip8_reset_state(&expected, NULL);
+    memcpy(&expected.memory[expected.pc], program, sizeof(program));
+    chip8_advance_state_batch(&expected, NULL, 8);
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_REGS), COMP_REGS);
+
+    // The generator is saved with the state, so a loaded state continues the same sequence
+    FILE *f = tmpfile();
+    if (f != NULL) {
+        initial.pc = PROGRAM_MEMORY_OFFSET;
+        expect_eq(chip8_dump_state(f, &initial, NULL), 0);
+        rewind(f);
+        expect_eq(chip8_load_state(f, &expected, NULL), 0);
+        fclose(f);
+
+        expect_eq(expected.rng_seed, 1234);
+        chip8_advance_state_batch(&initial, NULL, 8);
+        chip8_advance_state_batch(&expected, NULL, 8);
+        expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+    }
+
+    chip8_close_state(&initial, NULL);
+    chip8_close_state(&expected, NULL);
+}
+
+void test_dirty(void) {
+    struct chip8_state state;
+
+    chip8_init_state(&state, NULL);
+    expect_eq(state.dirty_rows, UINT64_MAX);
+
+    // D125 with V2 = 4 in lores covers rows 8 to 17
+    state.dirty_rows = 0;
+    state.registers[0x2] = 4;
+    state.index_register = FONT_MEMORY_OFFSET;
+    memcpy(&state.memory[state.pc], (const uint8_t []){0xD1, 0x25}, 2);
+    chip8_advance_state(&state, NULL);
+    expect_eq(state.dirty_rows, UINT64_C(0x3FF) << 8);
+
+    // 00FF D125 - the same sprite in hires covers rows 4 to 8
+    state.dirty_rows = 0;
+    memcpy(&state.memory[state.pc], (const uint8_t []){0x00, 0xFF, 0xD1, 0x25}, 4);
+    chip8_advance_state_batch(&state, NULL, 2);
+    expect_eq(state.dirty_rows, UINT64_C(0x1F) << 4);
+
+    // 00C0 - scrolling by 0 changes nothing, 00E0 changes everything
+    state.dirty_rows = 0;
+    memcpy(&state.memory[state.pc], (const uint8_t []){0x00, 0xC0}, 2);
+    chip8_advance_state(&state, NULL);
+    expect_eq(state.dirty_rows, 0);
+    memcpy(&state.memory[state.pc], (const uint8_t []){0x00, 0xE0}, 2);
+    chip8_advance_state(&state, NULL);
+    expect_eq(state.dirty_rows, UINT64_MAX);
+
+    chip8_close_state(&state, NULL);
+}
+
+void test_frames(void) {
+    static struct chip8_state state;
+    static struct chip8_frame_buffer buffer;
+
+    chip8_init_state(&state, NULL);
+    chip8_init_frame_buffer(&buffer);
+    expect_null(chip8_take_frame(&buffer));
+
+    // A lores frame keeps the 64x32 plane and takes over the dirty rows
+    state.index_register = FONT_MEMORY_OFFSET;
+    memcpy(&state.memory[state.pc], (const uint8_t []){0xD0, 0x05}, 2);
+    chip8_advance_state(&state, NULL);
+    struct chip8_frame *frame = chip8_back_frame(&buffer);
+    chip8_capture_frame(frame, &state, 1);
+    expect_true(frame->lores);
+    expect_eq(frame->planes[0][0], 0xF0);
+    expect_eq(frame->planes[0][DISPLAY_WIDTH / 16], 0x90);
+    expect_eq(frame->dirty_rows, UINT64_MAX);
+    expect_eq(state.dirty_rows, 0);
+    chip8_publish_frame(&buffer);
+
+    const struct chip8_frame *taken = chip8_take_frame(&buffer);
+    assert_non_null(taken);
+    expect_eq(taken->number, 1);
+    expect_null(chip8_take_frame(&buffer));
+
+    // Only the newest of two published frames is taken, carrying the rows of both
+    chip8_capture_frame(chip8_back_frame(&buffer), &state, 2);
+    chip8_back_frame(&buffer)->dirty_rows = 0x3;
+    chip8_publish_frame(&buffer);
+    chip8_capture_frame(chip8_back_frame(&buffer), &state, 3);
+    chip8_back_frame(&buffer)->dirty_rows = 0x30;
+    chip8_publish_frame(&buffer);
+    expect_true(chip8_back_frame(&buffer) != taken);
+    taken = chip8_take_frame(&buffer);
+    assert_non_null(taken);
+    expect_eq(taken->number, 3);
+    expect_eq(taken->dirty_rows, 0x33);
+
+    // Once taken, the next frame only carries its own rows
+    chip8_capture_frame(chip8_back_frame(&buffer), &state, 4);
+    chip8_back_frame(&buffer)->dirty_rows = 0x100;
+    chip8_publish_frame(&buffer);
+    taken = chip8_take_frame(&buffer);
+    assert_non_null(taken);
+    expect_eq(taken->dirty_rows, 0x100);
+
+    // The same sprite renders the same from a hires frame
+    static uint32_t lores[DISPLAY_HEIGHT][DISPLAY_WIDTH], hires[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    chip8_capture_frame(frame, &state, 5);
+    chip8_render_rows(frame, &lores[0][0], sizeof(lores[0]), 0, DISPLAY_HEIGHT - 1, false);
+    chip8_expand_lores(&state);
+    chip8_capture_frame(frame, &state, 6);
+    expect_false(frame->lores);
+    chip8_render_rows(frame, &hires[0][0], sizeof(hires[0]), 0, DISPLAY_HEIGHT - 1, false);
+    expect_eq_mem(lores, hires, sizeof(lores));
+    expect_eq(lores[1][1], chip8_palette[1]);
+    expect_eq(lores[2][2], chip8_palette[0]);
+
+    chip8_close_state(&state, NULL);
+}
+
+static int count_frame(const struct chip8_frame *frame, void *data) {
+    uint64_t *last = data;
+    *last = frame->number;
+    return (frame->number == 13) ? -1 : 0;
+}
+
+void test_display(void) {
+    static struct chip8_frame frame;
+    struct chip8_display display;
+    struct chip8_input input = {.keys = 0x5};
+    uint64_t last = 0;
+
+    // A headless display has no input of its own and only passes new frames to on_frame
+    expect_eq(chip8_init_headless_display(&display, NULL), 0);
+    expect_eq(chip8_poll_display(&display, &input, NULL), 0);
+    expect_eq(input.keys, 0x5);
+    expect_false(input.quit);
+
+    expect_eq(chip8_update_display(&display, NULL, NULL), 0);
+    frame.number = 12;
+    expect_eq(chip8_update_display(&display, &frame, NULL), 0);
+    expect_eq(last, 0);
+
+    display.on_frame = count_frame;
+    display.on_frame_data = &last;
+    expect_eq(chip8_update_display(&display, &frame, NULL), 0);
+    expect_eq(last, 12);
+    expect_eq(chip8_update_display(&display, NULL, NULL), 0);
+    expect_eq(last, 12);
+
+    // A failing callback fails the update
+    frame.number = 13;
+    expect_eq(chip8_update_display(&display, &frame, NULL), -1);
+
+    expect_eq(chip8_close_display(&display, NULL), 0);
+    expect_true(display.on_frame == NULL);
+}
+
+void test_record(void) {
+    static struct chip8_state state;
+    static struct chip8_recorder recorder;
+    static uint8_t video[4096 + 3 * 3 * DISPLAY_WIDTH * DISPLAY_HEIGHT];
+    char path[] = "/tmp/chip8-record-XXXXXX.y4m";
+    size_t frame_bytes = 3 * DISPLAY_WIDTH * DISPLAY_HEIGHT;
+
+    int fd = mkstemps(path, 4);
+    assert_neq(fd, -1);
+    close(fd);
+
+    // Three frames, the second a repeat of the first
+    chip8_init_state(&state, NULL);
+    assert_eq(chip8_open_recorder(&recorder, path, NULL), 0);
+    chip8_record_frame(&recorder, &state, 0, false);
+    chip8_record_frame(&recorder, &state, 1, false);
+    state.index_register = FONT_MEMORY_OFFSET;
+    memcpy(&state.memory[state.pc], (const uint8_t []){0xD0, 0x05}, 2);
+    chip8_advance_state(&state, NULL);
+    chip8_record_frame(&recorder, &state, 2, false);
+    expect_eq(chip8_close_recorder(&recorder, NULL), 0);
+    expect_eq(recorder.frames_written, 3);
+    expect_eq(recorder.frames_repeated, 1);
+
+    FILE *f = fopen(path, "rb");
+    assert_non_null(f);
+    size_t length = fread(video, 1, sizeof(video), f);
+    fclose(f);
+
+    const char header[] = "YUV4MPEG2 W128 H64 F60:1 Ip A1:1 C444\n";
+    size_t header_length = strlen(header);
+    expect_eq(length, header_length + 3 * (6 + frame_bytes));
+    expect_eq(memcmp(video, header, header_length), 0);
+
+    // The font's top left pixel is lit in the last frame only, doubled to 2x2
+    const uint8_t *first = &video[header_length + 6];
+    const uint8_t *last = &video[header_length + 2 * (6 + frame_bytes) + 6];
+    expect_eq(memcmp(first - 6, "FRAME\n", 6), 0);
+    expect_eq(first[0], recorder.yuv[0][0]);
+    expect_eq(last[0], recorder.yuv[1][0]);
+    expect_eq(last[DISPLAY_WIDTH + 1], recorder.yuv[1][0]);
+    expect_eq(last[4 * 2], recorder.yuv[0][0]);
+    expect_eq(last[frame_bytes / 3], recorder.yuv[1][1]);
+    expect_eq(memcmp(first, &video[header_length + 6 + frame_bytes + 6], frame_bytes), 0);
+    remove(path);
+
+    // PPM frames are whole images with their own header
+    char ppm_path[] = "/tmp/chip8-record-XXXXXX.ppm";
+    fd = mkstemps(ppm_path, 4);
+    assert_neq(fd, -1);
+    close(fd);
+    assert_eq(chip8_open_recorder(&recorder, ppm_path, NULL), 0);
+    chip8_record_frame(&recorder, &state, 3, false);
+    expect_eq(chip8_close_recorder(&recorder, NULL), 0);
+
+    f = fopen(ppm_path, "rb");
+    assert_non_null(f);
+    length = fread(video, 1, sizeof(video), f);
+    fclose(f);
+    expect_eq(length, strlen("P6\n128 64\n255\n") + frame_bytes);
+    expect_eq(memcmp(video, "P6\n128 64\n255\n", 14), 0);
+    expect_eq(video[14], (uint8_t) (chip8_palette[1] >> 16));
+
+    // Waiting for the writer keeps every frame, however far ahead the emulator runs
+    assert_eq(chip8_open_recorder(&recorder, ppm_path, NULL), 0);
+    for (uint64_t i = 0; i < 4 * RECORD_QUEUE_LENGTH; i++) {
+        chip8_record_frame(&recorder, &state, i, true);
+    }
+    expect_eq(chip8_close_recorder(&recorder, NULL), 0);
+    expect_eq(recorder.frames_written, 4 * RECORD_QUEUE_LENGTH);
+    expect_eq(recorder.frames_dropped, 0);
+    remove(ppm_path);
+
+    chip8_close_state(&state, NULL);
+}
+
+void test_wav(void) {
+    static struct chip8_state state;
+    static struct chip8_wav wav, memory;
+    static uint8_t audio[64 + 4 * SOUND_FRAME_SAMPLES];
+    const struct chip8_config config = {.waveform = WAVE_SQUARE};
+    char path[] = "/tmp/chip8-wav-XXXXXX.wav";
+
+    int fd = mkstemps(path, 4);
+    assert_neq(fd, -1);
+    close(fd);
+
+    // A silent frame, then one with the beeper on
+    chip8_init_state(&state, NULL);
+    assert_eq(chip8_open_wav(&memory, NULL, &config), 0);
+    assert_eq(chip8_open_wav(&wav, path, &config), 0);
+    chip8_write_wav_frame(&memory, &state);
+    chip8_write_wav_frame(&wav, &state);
+    state.sound_timer = 2;
+    chip8_write_wav_frame(&memory, &state);
+    chip8_write_wav_frame(&wav, &state);
+
+    expect_eq(memory.length, 2 * SOUND_FRAME_SAMPLES);
+    expect_eq(memory.samples[SOUND_FRAME_SAMPLES - 1], 0);
+    expect_eq(memory.samples[SOUND_FRAME_SAMPLES], (int16_t) lrintf(SOUND_VOLUME * INT16_MAX));
+    expect_eq(memory.samples[SOUND_FRAME_SAMPLES + 60], (int16_t) -lrintf(SOUND_VOLUME * INT16_MAX));
+    expect_eq(wav.hash, memory.hash);
+    expect_eq(chip8_close_wav(&wav, &config), 0);
+
+    // The header is completed on close and the data is the same as what was kept in memory
+    FILE *f = fopen(path, "rb");
+    assert_non_null(f);
+    size_t length = fread(audio, 1, sizeof(audio), f);
+    fclose(f);
+    expect_eq(length, 44 + 4 * SOUND_FRAME_SAMPLES);
+    expect_eq(memcmp(audio, "RIFF", 4), 0);
+    expect_eq(audio[4] | audio[5] << 8, 36 + 4 * SOUND_FRAME_SAMPLES);
+    expect_eq(memcmp(&audio[8], "WAVEfmt ", 8), 0);
+    expect_eq(memcmp(&audio[36], "data", 4), 0);
+    expect_eq(audio[40] | audio[41] << 8, 4 * SOUND_FRAME_SAMPLES);
+    expect_eq((int16_t) (audio[44 + 2 * SOUND_FRAME_SAMPLES] | audio[45 + 2 * SOUND_FRAME_SAMPLES] << 8), memory.samples[SOUND_FRAME_SAMPLES]);
+    remove(path);
+
+    // Every run of the same frames sounds the same, whatever path the tone takes
+    uint64_t hash = memory.hash;
+    expect_eq(chip8_close_wav(&memory, &config), 0);
+    assert_eq(chip8_open_wav(&memory, NULL, &config), 0);
+#ifdef __x86_64__
+    memory.tone.use_avx2 = !memory.tone.use_avx2 && __builtin_cpu_supports("avx2");
+#endif
+    state.sound_timer = 0;
+    chip8_write_wav_frame(&memory, &state);
+    memory.length = 0;
+    state.sound_timer = 2;
+    chip8_write_wav_frame(&memory, &state);
+    expect_eq(memory.hash, hash);
+    expect_eq(memory.length, SOUND_FRAME_SAMPLES);
+    expect_eq(chip8_close_wav(&memory, &config), 0);
+
+    chip8_close_state(&state, NULL);
+}
+
+static int write_program(char *path, const uint8_t *program, size_t length) {
+    int fd = mkstemps(path, 4);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t written = write(fd, program, length);
+    close(fd);
+    return (written == (ssize_t) length) ? 0 : -1;
+}
+
+void test_load_program(void) {
+    struct chip8_state state;
+    const struct chip8_config config = {.target_speed = 600};
+    char first[] = "/tmp/chip8-program-XXXXXX.ch8";
+    char second[] = "/tmp/chip8-program-XXXXXX.ch8";
+
+    // 7001 1200 and 7102 1200 - two counting loops at the same address
+    assert_eq(write_program(first, (const uint8_t []){0x70, 0x01, 0x12, 0x00}, 4), 0);
+    assert_eq(write_program(second, (const uint8_t []){0x71, 0x02, 0x12, 0x00}, 4), 0);
+
+    chip8_init_state(&state, NULL);
+    assert_eq(chip8_load_program(&state, &config, first), 0);
+    chip8_advance_frame(&state, &config, 0);
+    expect_eq(state.registers[0x0], 5);
+
+    // Loading over it without a reset runs the new program, not code compiled for the old one
+    assert_eq(chip8_load_program(&state, &config, second), 0);
+    state.pc = PROGRAM_MEMORY_OFFSET;
+    chip8_advance_frame(&state, &config, 1);
+    expect_eq(state.registers[0x0], 5);
+    expect_eq(state.registers[0x1], 10);
+    expect_eq(state.memory[PROGRAM_MEMORY_OFFSET + 4], 0);
+
+    // Restoring a savestate over another ROM drops what was derived from that ROM
+    FILE *f = tmpfile();
+    if (f != NULL) {
+        expect_eq(chip8_dump_state(f, &state, NULL), 0);
+        assert_eq(chip8_load_program(&state, &config, first), 0);
+        rewind(f);
+        expect_eq(chip8_load_state(f, &state, NULL), 0);
+        fclose(f);
+        expect_true(state.analysis == NULL);
+        expect_true(state.aot == NULL);
+        chip8_advance_frame(&state, &config, 2);
+        expect_eq(state.registers[0x0], 5);
+        expect_eq(state.registers[0x1], 20);
+    }
+
+    remove(first);
+    remove(second);
+    chip8_close_state(&state, NULL);
+}
+
+void test_decoded(void) {
+    struct chip8_state initial, expected;
+
+    // 6142 A200 F055 1200 - overwrite an already decoded instruction with 7142 and run it again
+    chip8_init_state(&initial, NULL);
+    chip8_init_state(&expected, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x61, 0x42, 0xA2, 0x00, 0xF0, 0x55, 0x12, 0x00}, 8);
+    initial.registers[0x0] = 0x71;
+    for (int i = 0; i < 5; i++) {
+        chip8_advance_state(&initial, NULL);
+    }
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0x71, 0x42, 0xA2, 0x00, 0xF0, 0x55, 0x12, 0x00}, 8);
+    expected.registers[0x0] = 0x71;
+    expected.registers[0x1] = 0x84;
+    expected.index_register = 0x200;
+    expected.pc += 2;
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // F233 1200 - BCD written over the decoded jump turns it into 1202
+    chip8_reset_state(&initial, NULL);
+    chip8_reset_state(&expected, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0xF2, 0x33, 0x12, 0x00}, 4);
+    initial.index_register = 0x203;
+    initial.registers[0x2] = 200;
+    chip8_decode_memory(&initial);
+    chip8_advance_state(&initial, NULL);
+    chip8_advance_state(&initial, NULL);
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0xF2, 0x33, 0x12, 0x02, 0x00, 0x00}, 6);
+    expected.index_register = 0x203;
+    expected.registers[0x2] = 200;
+    expected.pc = 0x202;
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // 60FF BFFF - a jump past the end of memory runs the 7101 wrapped around to 0x0FE
+    chip8_reset_state(&initial, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x60, 0xFF, 0xBF, 0xFF}, 4);
+    memcpy(&initial.memory[0x0FE], (const uint8_t []){0x71, 0x01}, 2);
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 3), 3);
+    expect_eq(initial.registers[0x1], 1);
+    expect_eq(initial.pc, 0x1100);
+
+    chip8_close_state(&initial, NULL);
+    chip8_close_state(&expected, NULL);
+}
+
+void test_batch(void) {
+    struct chip8_state initial, expected;
+
+    const uint8_t program[] = {
+        0x60, 0x00, 0x70, 0x01, 0x81, 0x04, 0x82, 0x15, 0x83, 0x07, 0x84, 0x01, 0x85, 0x32, 0x86, 0x13,
+        0xA1, 0x23, 0xF6, 0x1E, 0x87, 0x10, 0x83, 0x06, 0x88, 0x4E, 0x89, 0x17, 0x3F, 0x01, 0x12, 0x02,
+        0x12, 0x04
+    };
+
+    // Arithmetic loop - batched execution matches stepping one instruction at a time
+    chip8_init_state(&initial, NULL);
+    chip8_init_state(&expected, NULL);
+    memcpy(&initial.memory[initial.pc], program, sizeof(program));
+    memcpy(&expected.memory[expected.pc], program, sizeof(program));
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 1000), 1000);
+    for (int i = 0; i < 1000; i++) {
+        chip8_advance_state(&expected, NULL);
+    }
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // 6142 A200 F055 1200 - batched execution picks up code written by FX55
+    chip8_reset_state(&initial, NULL);
+    chip8_reset_state(&expected, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x61, 0x42, 0xA2, 0x00, 0xF0, 0x55, 0x12, 0x00}, 8);
+    initial.registers[0x0] = 0x71;
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 6), 6);
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0x71, 0x42, 0xA2, 0x00, 0xF0, 0x55, 0x12, 0x00}, 8);
+    expected.registers[0x0] = 0x71;
+    expected.registers[0x1] = 0x84;
+    expected.index_register = 0x200;
+    expected.pc += 4;
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    chip8_close_state(&initial, NULL);
+    chip8_close_state(&expected, NULL);
+}
+
+void test_idle(void) {
+    struct chip8_state initial, expected;
+
+    chip8_init_state(&initial, NULL);
+    chip8_init_state(&expected, NULL);
+
+    // 1200 - a jump to itself is idle straight away
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x12, 0x00}, 2);
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0x12, 0x00}, 2);
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 1000), 0);
+    expect_true(initial.idle);
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    // 6001 F007 3000 1202 - polling the delay timer is idle until it reaches 0
+    chip8_reset_state(&initial, NULL);
+    chip8_reset_state(&expected, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x60, 0x01, 0xF0, 0x07, 0x30, 0x00, 0x12, 0x02, 0x61, 0x01}, 10);
+    memcpy(&expected.memory[expected.pc], (const uint8_t []){0x60, 0x01, 0xF0, 0x07, 0x30, 0x00, 0x12, 0x02, 0x61, 0x01}, 10);
+    initial.delay_timer = 5;
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 1000), 3);
+    expect_true(initial.idle);
+    expected.delay_timer = 5;
+    expected.registers[0x0] = 5;
+    expected.pc += 6;
+    expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+
+    initial.delay_timer = 0;
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 4), 4);
+    expect_false(initial.idle);
+    expect_eq(initial.registers[0x1], 1);
+
+    // 4001 in place of 3000 - waits while the timer is 1 instead
+    chip8_reset_state(&initial, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0x60, 0x01, 0xF0, 0x07, 0x40, 0x01, 0x12, 0x02}, 8);
+    initial.delay_timer = 1;
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 1000), 3);
+    expect_true(initial.idle);
+    initial.delay_timer = 0;
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 3), 3);
+    expect_false(initial.idle);
+    expect_eq(initial.pc, 0x208);
+
+    // F30A - waiting for a key is idle until one is pressed
+    chip8_reset_state(&initial, NULL);
+    memcpy(&initial.memory[initial.pc], (const uint8_t []){0xF3, 0x0A, 0x12, 0x02}, 4);
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 1000), 0);
+    expect_true(initial.idle);
+    expect_eq(initial.pc, 0x200);
+    initial.keys[0x9] = true;
+    expect_eq(chip8_advance_state_batch(&initial, NULL, 1), 1);
+    expect_false(initial.idle);
+    expect_eq(initial.registers[0x3], 0x9);
+    expect_eq(initial.pc, 0x202);
+
+    chip8_close_state(&initial, NULL);
+    chip8_close_state(&expected, NULL);
+}
+
+void test_analysis(void) {
+    static uint8_t memory[4096];
+
+    // 2208 3001 1204 1206 A20E F033 00EE FFFF - a call, a skip between two waits, and a BCD into data
+    const uint8_t program[] = {0x22, 0x08, 0x30, 0x01, 0x12, 0x04, 0x12, 0x06, 0xA2, 0x0E, 0xF0, 0x33, 0x00, 0xEE, 0xFF, 0xFF};
+    memcpy(&memory[PROGRAM_MEMORY_OFFSET], program, sizeof(program));
+
+    const struct chip8_analysis *analysis = chip8_analyze(memory, PROGRAM_MEMORY_OFFSET + sizeof(program));
+    assert_non_null(analysis);
+
+    expect_eq(analysis->num_blocks, 6);
+    expect_eq(analysis->blocks[4].start, 0x208);
+    expect_eq(analysis->blocks[4].length, 2);
+    expect_eq(analysis->num_calls, 1);
+    expect_eq(analysis->calls[0].site, 0x200);
+    expect_eq(analysis->calls[0].target, 0x208);
+
+    expect_eq(analysis->flags[0x200], ANALYSIS_INSTRUCTION | ANALYSIS_CODE | ANALYSIS_LEADER);
+    expect_eq(analysis->flags[0x204], ANALYSIS_INSTRUCTION | ANALYSIS_CODE | ANALYSIS_LEADER | ANALYSIS_WAIT);
+    expect_eq(analysis->flags[0x208], ANALYSIS_INSTRUCTION | ANALYSIS_CODE | ANALYSIS_LEADER | ANALYSIS_SUBROUTINE);
+    expect_eq(analysis->flags[0x20A], ANALYSIS_INSTRUCTION | ANALYSIS_CODE);
+    expect_eq(analysis->flags[0x20E], ANALYSIS_WRITTEN);
+    expect_eq(analysis->flags[0x211], 0);
+    expect_false(analysis->indirect_jumps);
+    expect_false(analysis->unknown_writes);
+    expect_false(analysis->self_modifying);
+
+    // The same ROM is only analysed once
+    expect_true(chip8_analyze(memory, PROGRAM_MEMORY_OFFSET + sizeof(program)) == analysis);
+
+    // A20A - the BCD now lands on the code that follows it
+    memory[0x209] = 0x0A;
+    analysis = chip8_analyze(memory, PROGRAM_MEMORY_OFFSET + sizeof(program));
+    assert_non_null(analysis);
+    expect_true(analysis->self_modifying);
+    expect_eq(analysis->flags[0x20C], ANALYSIS_INSTRUCTION | ANALYSIS_CODE | ANALYSIS_LEADER | ANALYSIS_WRITTEN);
+
+    // 2203 3030 ... - a call to an odd address makes skips at both odd and even addresses, more blocks than words
+    memory[0x200] = 0x22;
+    memory[0x201] = 0x03;
+    memset(&memory[0x202], 0x30, sizeof(memory) - 0x202);
+    analysis = chip8_analyze(memory, sizeof(memory));
+    assert_non_null(analysis);
+    expect_true(analysis->num_blocks > sizeof(memory) / 2);
+    expect_eq(analysis->num_calls, 1);
+    expect_eq(analysis->calls[0].site, 0x200);
+    expect_eq(analysis->calls[0].target, 0x203);
+}
+
+// Only has something to check when built with AOT=...
+void test_aot(void) {
+    struct chip8_state initial, expected;
+    const struct chip8_config config = {.target_speed = 1000};
+
+    chip8_init_state(&initial, NULL);
+    chip8_init_state(&expected, NULL);
+
+    // Each compiled ROM behaves exactly like the interpreted one
+    for (size_t i = 0; chip8_aot_programs[i] != NULL; i++) {
+        const struct chip8_aot_program *program = chip8_aot_programs[i];
+
+        chip8_reset_state(&initial, NULL);
+        chip8_reset_state(&expected, NULL);
+        memcpy(&initial.memory[initial.pc], program->rom, program->rom_length);
+        memcpy(&expected.memory[expected.pc], program->rom, program->rom_length);
+        initial.aot = chip8_find_aot(program->rom, program->rom_length);
+        expect_true(initial.aot == program);
+
+        chip8_seed_state(&initial, i);
+        chip8_seed_state(&expected, i);
+        for (uint64_t frame = 0; frame < 300; frame++) {
+            chip8_advance_frame(&initial, &config, frame);
+        }
+        for (uint64_t frame = 0; frame < 300; frame++) {
+            chip8_advance_frame(&expected, &config, frame);
+        }
+
+        expect_eq(chip8_compare_states(&initial, &expected, COMP_ALL), 0);
+    }
+
+    chip8_close_state(&initial, NULL);
+    chip8_close_state(&expected, NULL);
+}
+
+void test_multi(void) {
+    struct chip8_multi multi;
+    struct chip8_state expected;
+    const struct chip8_config timers_only = {.target_speed = 0};
+
+    // Lanes diverge on the skips, and F233 writes memory so those lanes stop sharing code
+    const uint8_t program[] = {
+        0x70, 0x01, 0x81, 0x04, 0x82, 0x15, 0x83, 0x27, 0x3F, 0x01, 0x84, 0x06, 0x45, 0x00, 0x85, 0x3E,
+        0x86, 0x11, 0x87, 0x12, 0x88, 0x13, 0x50, 0x10, 0x69, 0x07, 0x90, 0x20, 0x79, 0x03, 0xA3, 0x00,
+        0x32, 0x40, 0x12, 0x26, 0xF2, 0x33, 0x6A, 0x5A, 0x8F, 0xA4, 0x12, 0x00
+    };
+
+    chip8_init_state(&expected, NULL);
+
+    for (int avx2 = 0; avx2 <= 1; avx2++) {
+        chip8_init_multi(&multi, NULL, 45);
+        chip8_load_multi_memory(&multi, NULL, program, sizeof(program));
+        multi.use_avx2 &= avx2;
+
+        for (size_t i = 0; i < multi.num_lanes; i++) {
+            multi.registers[0x0][i] = 7 * i;
+            multi.registers[0x1][i] = 0xF0 + i;
+            multi.registers[0x2][i] = 3 * i;
+            multi.registers[0x3][i] = i;
+            multi.registers[0x5][i] = i % 3;
+            multi.delay_timer[i] = i;
+        }
+
+        expect_eq(chip8_advance_multi(&multi, NULL, 500), 0);
+        expect_eq(chip8_advance_multi_frame(&multi, &timers_only, 0), 0);
+        chip8_sync_multi(&multi);
+
+        // Each lane matches running the same program on its own
+        for (size_t i = 0; i < multi.num_lanes; i++) {
+            chip8_reset_state(&expected, NULL);
+            memcpy(&expected.memory[expected.pc], program, sizeof(program));
+            expected.registers[0x0] = 7 * i;
+            expected.registers[0x1] = 0xF0 + i;
+            expected.registers[0x2] = 3 * i;
+            expected.registers[0x3] = i;
+            expected.registers[0x5] = i % 3;
+            expected.delay_timer = i;
+
+            for (int j = 0; j < 500; j++) {
+                chip8_advance_state(&expected, NULL);
+            }
+            chip8_advance_frame(&expected, &timers_only, 0);
+
+            expect_eq(chip8_compare_states(&multi.states[i], &expected, COMP_ALL), 0);
+        }
+
+        chip8_close_multi(&multi, NULL);
+    }
+
+    chip8_close_state(&expected, NULL);
+}
+
 int main(void) {
     test_scroll();
     test_draw();
     test_func();
     test_res();
+    test_lores();
+    test_planes();
+    test_phosphor();
+    test_tone();
+    test_sound_ring();
+    test_rate_control();
+    test_audio_pattern();
     test_jump();
     test_skip();
     test_reg_ops();
@@ -1555,6 +2711,19 @@ int main(void) {
     test_bcd();
     test_sprite();
     test_reg_ldst();
+    test_random();
+    test_dirty();
+    test_frames();
+    test_display();
+    test_record();
+    test_wav();
+    test_load_program();
+    test_decoded();
+    test_batch();
+    test_idle();
+    test_analysis();
+    test_aot();
+    test_multi();
 
     summarize_tests();
     return EXIT_SUCCESS;